@@ -0,0 +1,737 @@
+/* TextGameServer/account_store.c */
+#include "account_store.h"
+#include "utils.h"
+#include "mem_stats.h"
+#include "completion_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define ACC_MAGIC               "TGSACC1"
+#define ACC_VERSION             1
+#define ACC_MIN_SLOTS           1024
+// Table load is kept under 1/2, so that probes stay short
+#define ACC_MAX_LOAD_NUM        1
+#define ACC_MAX_LOAD_DEN        2
+
+// Compaction rewrites the whole table, so it waits until the delta is a
+//  fraction of the table: O(1) amortized per registration. The cap bounds
+//  the delta replayed at startup (64MB of records)
+#define ACC_COMPACT_THRESHOLD   1024
+#define ACC_COMPACT_FRACTION    8
+#define ACC_COMPACT_MAX_DELTA   (1 << 18)
+#define INIT_DELTA_SIZE         64
+#define INIT_WRITE_QUEUE_SIZE   64
+// Max registrations committed with one write+fdatasync
+#define ACC_GROUP_MAX           128
+
+#define PATH_BUF_SIZE           256
+
+// Both the table slots and the delta file entries are these records.
+//  An empty table slot has an empty username
+typedef struct acc_record_tag {
+    char usernm[72];
+    char passwd[184];
+} acc_record_t;
+
+typedef union acc_db_header_tag {
+    struct {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t num_slots;
+        uint64_t num_records;
+    } h;
+    acc_record_t pad;
+} acc_db_header_t;
+
+typedef enum compaction_state_tag {
+    cs_idle,
+    cs_running,
+    cs_done,
+    cs_failed
+} compaction_state_t;
+
+typedef enum write_job_type_tag {
+    wj_append,
+    wj_drop_prefix
+} write_job_type_t;
+
+// Allocated and freed on the owner thread, the writer hands them back
+//  through the completion queue
+typedef struct write_job_tag {
+    write_job_type_t type;
+    account_store_t *as;
+
+    // wj_append
+    acc_record_t rec;
+    acc_add_done_func_t done_f;
+    void *ctx;
+
+    // wj_drop_prefix
+    int drop_cnt;
+} write_job_t;
+
+struct account_store_tag {
+    char db_path[PATH_BUF_SIZE];
+    char db_tmp_path[PATH_BUF_SIZE];
+    char delta_path[PATH_BUF_SIZE];
+    char delta_tmp_path[PATH_BUF_SIZE];
+
+    // Read-only mapping of the table file
+    acc_db_header_t *map;
+    size_t map_size;
+    acc_record_t *slots;
+
+    // Records from the delta file, in append order, and an index over them.
+    //  After acc_open the file itself belongs to the writer thread
+    int delta_fd;
+    acc_record_t **delta;
+    int delta_cnt, delta_cap;
+    hash_map_t delta_index;
+
+    // Compaction: the thread reads the old mapping and a snapshot of the
+    //  first compact_cnt delta records, the owner thread swaps the result in
+    pthread_t compaction_thread;
+    pthread_mutex_t mutex;
+    compaction_state_t compaction_state;
+    acc_record_t *compact_recs;
+    int compact_cnt;
+
+    // Writer thread: jobs are executed in queue order, so the file always
+    //  holds the committed records in the same order as the delta array
+    pthread_t writer_thread;
+    bool writer_started;
+    pthread_mutex_t write_mutex;
+    pthread_cond_t write_cond;
+    ring_buf_t write_queue;
+    bool writer_stop;
+
+    // Registrations in flight, owner thread only
+    hash_map_t pending_index;
+};
+
+static_assert(sizeof(acc_record_t) == 256, "Account record must stay 256 bytes");
+static_assert(sizeof(((acc_record_t *) 0)->usernm) > ACC_USERNAME_MAX_LEN && sizeof(((acc_record_t *) 0)->passwd) > ACC_PASSWD_MAX_LEN,
+              "Account record fields are too small");
+
+static void *writer_thread_main(void *data);
+static void queue_write_job(account_store_t *as, write_job_t *job);
+static void append_done(void *ctx, bool ok);
+
+static bool fill_record(acc_record_t *rec, const char *usernm, const char *passwd)
+{
+    size_t ulen = strlen(usernm);
+    size_t plen = strlen(passwd);
+    if (ulen == 0 || ulen > ACC_USERNAME_MAX_LEN || plen == 0 || plen > ACC_PASSWD_MAX_LEN)
+        return false;
+
+    memset(rec, 0, sizeof(*rec));
+    memcpy(rec->usernm, usernm, ulen);
+    memcpy(rec->passwd, passwd, plen);
+    return true;
+}
+
+static acc_record_t *table_probe(acc_record_t *slots, uint64_t num_slots, const char *usernm)
+{
+    uint64_t mask = num_slots-1;
+    uint64_t idx = hash_str(usernm) & mask;
+    for (uint64_t i = 0; i < num_slots; i++) {
+        acc_record_t *rec = &slots[(idx + i) & mask];
+        if (!rec->usernm[0] || streq(rec->usernm, usernm))
+            return rec;
+    }
+
+    return NULL; // Full table, can not happen with the load limit
+}
+
+static acc_record_t *table_find(account_store_t *as, const char *usernm)
+{
+    if (!as->map)
+        return NULL;
+
+    acc_record_t *rec = table_probe(as->slots, as->map->h.num_slots, usernm);
+    return rec && rec->usernm[0] ? rec : NULL;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t wc = write(fd, p, len);
+        if (wc < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += wc;
+        len -= wc;
+    }
+    return true;
+}
+
+// Builds a complete table file at path from the old table (may be NULL) and
+//  extra records, then syncs it. Runs on the compaction thread too.
+//  With extra_overrides, a later record replaces an earlier one for the same
+//  user (delta semantics), otherwise the first one is kept
+static bool write_table(const char *path, acc_db_header_t *old_map,
+                        acc_record_t *extra, int extra_cnt, bool extra_overrides)
+{
+    acc_record_t *old_slots = old_map ? (acc_record_t *) (old_map + 1) : NULL;
+    uint64_t old_slots_cnt = old_map ? old_map->h.num_slots : 0;
+    uint64_t num_records = (old_map ? old_map->h.num_records : 0) + extra_cnt;
+
+    uint64_t num_slots = ACC_MIN_SLOTS;
+    while (num_records * ACC_MAX_LOAD_DEN >= num_slots * ACC_MAX_LOAD_NUM)
+        num_slots *= 2;
+
+    size_t size = sizeof(acc_db_header_t) + num_slots * sizeof(acc_record_t);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return false;
+    }
+
+    acc_db_header_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    acc_record_t *slots = (acc_record_t *) (map + 1);
+    uint64_t inserted = 0;
+
+    for (uint64_t i = 0; i < old_slots_cnt; i++) {
+        if (!old_slots[i].usernm[0])
+            continue;
+        acc_record_t *rec = table_probe(slots, num_slots, old_slots[i].usernm);
+        if (!rec->usernm[0]) {
+            *rec = old_slots[i];
+            inserted++;
+        }
+    }
+    for (int i = 0; i < extra_cnt; i++) {
+        acc_record_t *rec = table_probe(slots, num_slots, extra[i].usernm);
+        if (!rec->usernm[0]) {
+            *rec = extra[i];
+            inserted++;
+        } else if (extra_overrides)
+            *rec = extra[i];
+    }
+
+    memcpy(map->h.magic, ACC_MAGIC, sizeof(map->h.magic));
+    map->h.version = ACC_VERSION;
+    map->h.record_size = sizeof(acc_record_t);
+    map->h.num_slots = num_slots;
+    map->h.num_records = inserted;
+
+    bool ok = msync(map, size, MS_SYNC) == 0;
+    munmap(map, size);
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static bool map_table(account_store_t *as)
+{
+    int fd = open(as->db_path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(acc_db_header_t)) {
+        close(fd);
+        return false;
+    }
+
+    acc_db_header_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    uint64_t num_slots = map->h.num_slots;
+    if (
+            memcmp(map->h.magic, ACC_MAGIC, sizeof(ACC_MAGIC)) != 0 ||
+            map->h.version != ACC_VERSION ||
+            map->h.record_size != sizeof(acc_record_t) ||
+            num_slots == 0 || (num_slots & (num_slots-1)) != 0 ||
+            st.st_size != sizeof(acc_db_header_t) + num_slots * sizeof(acc_record_t)
+       )
+    {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    // Lookups jump around the table
+    madvise(map, st.st_size, MADV_RANDOM);
+
+    as->map = map;
+    as->map_size = st.st_size;
+    as->slots = (acc_record_t *) (map + 1);
+    return true;
+}
+
+static void unmap_table(account_store_t *as)
+{
+    if (as->map)
+        munmap(as->map, as->map_size);
+    as->map = NULL;
+    as->slots = NULL;
+    as->map_size = 0;
+}
+
+// Same format and rules as the old hub passwd.txt: whitespace-separated
+//  username/password pairs, first record for a username wins
+static bool import_legacy_file(account_store_t *as, const char *legacy_path)
+{
+    FILE *f = fopen(legacy_path, "r");
+    if (!f)
+        return write_table(as->db_path, NULL, NULL, 0, false);
+
+    acc_record_t *recs = NULL;
+    int cnt = 0, cap = 0;
+
+    char usernm_buf[ACC_USERNAME_MAX_LEN+2];
+    char cred_buf[ACC_USERNAME_MAX_LEN+2];
+    size_t buflen;
+    int break_c = '\0';
+    bool ok = true;
+
+    bool reading_usernm = true;
+    while (break_c != EOF) {
+        buflen = fread_word_to_buf(f, cred_buf, sizeof(cred_buf), &break_c);
+        if (buflen == 0)
+            continue;
+        else if (buflen > ACC_USERNAME_MAX_LEN) {
+            ok = false;
+            break;
+        }
+
+        if (reading_usernm)
+            memcpy(usernm_buf, cred_buf, buflen+1);
+        else {
+            if (cnt >= cap) {
+                cap = cap ? cap*2 : INIT_DELTA_SIZE;
+                recs = realloc(recs, cap * sizeof(*recs));
+            }
+            fill_record(&recs[cnt++], usernm_buf, cred_buf);
+        }
+
+        reading_usernm = !reading_usernm;
+    }
+    fclose(f);
+
+    ok = ok && reading_usernm && write_table(as->db_path, NULL, recs, cnt, false);
+    free(recs);
+    return ok;
+}
+
+static void delta_push(account_store_t *as, const acc_record_t *rec)
+{
+    if (as->delta_cnt >= as->delta_cap) {
+        as->delta_cap *= 2;
+        as->delta = MEM_REALLOC(as->delta, as->delta_cap * sizeof(*as->delta));
+    }
+
+    acc_record_t *copy = MEM_ALLOC(mt_accounts, NULL, sizeof(*copy));
+    *copy = *rec;
+    as->delta[as->delta_cnt++] = copy;
+
+    // Newer records shadow older ones
+    hm_put(&as->delta_index, copy->usernm, copy);
+}
+
+static bool load_delta(account_store_t *as)
+{
+    as->delta_fd = open(as->delta_path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (as->delta_fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(as->delta_fd, &st) != 0)
+        return false;
+
+    // A torn record at the tail is a registration that never completed
+    off_t whole = st.st_size - st.st_size % sizeof(acc_record_t);
+    if (whole != st.st_size && ftruncate(as->delta_fd, whole) != 0)
+        return false;
+
+    acc_record_t rec;
+    for (off_t off = 0; off < whole; off += sizeof(rec)) {
+        if (pread(as->delta_fd, &rec, sizeof(rec), off) != sizeof(rec))
+            return false;
+        rec.usernm[sizeof(rec.usernm)-1] = '\0';
+        rec.passwd[sizeof(rec.passwd)-1] = '\0';
+        if (rec.usernm[0])
+            delta_push(as, &rec);
+    }
+
+    return true;
+}
+
+static void queue_write_job(account_store_t *as, write_job_t *job)
+{
+    pthread_mutex_lock(&as->write_mutex);
+    rb_push_back(&as->write_queue, job);
+    pthread_cond_signal(&as->write_cond);
+    pthread_mutex_unlock(&as->write_mutex);
+}
+
+// Commits a group of appends: one write, one fdatasync. On failure the file
+//  is cut back, so that a partial group does not shift the following records
+static bool commit_appends(account_store_t *as, write_job_t **jobs, int cnt, acc_record_t *buf)
+{
+    for (int i = 0; i < cnt; i++)
+        buf[i] = jobs[i]->rec;
+
+    struct stat st;
+    if (fstat(as->delta_fd, &st) != 0)
+        return false;
+
+    if (!write_all(as->delta_fd, buf, cnt * sizeof(*buf)) || fdatasync(as->delta_fd) != 0) {
+        if (ftruncate(as->delta_fd, st.st_size) != 0)
+            LOG_ERR("Failed to roll back the account delta file");
+        return false;
+    }
+
+    return true;
+}
+
+// Rewrites the delta file without the first drop_cnt records
+static bool drop_delta_prefix(account_store_t *as, int drop_cnt)
+{
+    int fd = open(as->delta_tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+
+    acc_record_t rec;
+    bool ok = true;
+    for (off_t off = (off_t) drop_cnt * sizeof(rec); ok; off += sizeof(rec)) {
+        ssize_t rc = pread(as->delta_fd, &rec, sizeof(rec), off);
+        if (rc == 0)
+            break;
+        ok = rc == sizeof(rec) && write_all(fd, &rec, sizeof(rec));
+    }
+    ok = ok && fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(as->delta_tmp_path, as->delta_path) != 0)
+        return false;
+
+    close(as->delta_fd);
+    as->delta_fd = open(as->delta_path, O_RDWR | O_APPEND);
+    return as->delta_fd >= 0;
+}
+
+static void drop_done(void *ctx, bool ok)
+{
+    if (!ok)
+        LOG_ERR("Failed to truncate the account delta file, it will be replayed");
+    mem_free(ctx);
+}
+
+static void *writer_thread_main(void *data)
+{
+    account_store_t *as = data;
+    write_job_t *group[ACC_GROUP_MAX];
+    acc_record_t *buf = malloc(ACC_GROUP_MAX * sizeof(*buf));
+
+    for (;;) {
+        pthread_mutex_lock(&as->write_mutex);
+        while (rb_is_empty(&as->write_queue) && !as->writer_stop)
+            pthread_cond_wait(&as->write_cond, &as->write_mutex);
+
+        if (rb_is_empty(&as->write_queue)) {
+            pthread_mutex_unlock(&as->write_mutex);
+            break;
+        }
+
+        // Take all appends that have piled up, up to a drop job
+        int cnt = 0;
+        write_job_t *drop_job = NULL;
+        while (!rb_is_empty(&as->write_queue) && cnt < ACC_GROUP_MAX) {
+            write_job_t *job = rb_at(&as->write_queue, 0);
+            if (job->type == wj_drop_prefix) {
+                if (cnt == 0)
+                    drop_job = rb_pop_front(&as->write_queue);
+                break;
+            }
+            group[cnt++] = rb_pop_front(&as->write_queue);
+        }
+        pthread_mutex_unlock(&as->write_mutex);
+
+        if (drop_job) {
+            bool ok = as->delta_fd >= 0 && drop_delta_prefix(as, drop_job->drop_cnt);
+            cq_post(drop_done, drop_job, ok);
+        } else {
+            bool ok = as->delta_fd >= 0 && commit_appends(as, group, cnt, buf);
+            for (int i = 0; i < cnt; i++)
+                cq_post(append_done, group[i], ok);
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+account_store_t *acc_open(const char *path_prefix, const char *legacy_passwd_path)
+{
+    account_store_t *as = MEM_CALLOC(mt_accounts, NULL, 1, sizeof(*as));
+    snprintf(as->db_path, sizeof(as->db_path), "%s.db", path_prefix);
+    snprintf(as->db_tmp_path, sizeof(as->db_tmp_path), "%s.db.tmp", path_prefix);
+    snprintf(as->delta_path, sizeof(as->delta_path), "%s.delta", path_prefix);
+    snprintf(as->delta_tmp_path, sizeof(as->delta_tmp_path), "%s.delta.tmp", path_prefix);
+
+    as->delta_fd = -1;
+    as->delta_cap = INIT_DELTA_SIZE;
+    as->delta = MEM_ALLOC(mt_accounts, NULL, as->delta_cap * sizeof(*as->delta));
+    hm_init(&as->delta_index, INIT_DELTA_SIZE);
+
+    pthread_mutex_init(&as->mutex, NULL);
+    as->compaction_state = cs_idle;
+
+    pthread_mutex_init(&as->write_mutex, NULL);
+    pthread_cond_init(&as->write_cond, NULL);
+    rb_init(&as->write_queue, INIT_WRITE_QUEUE_SIZE);
+    hm_init(&as->pending_index, INIT_WRITE_QUEUE_SIZE);
+
+    if (access(as->db_path, F_OK) != 0) {
+        if (!legacy_passwd_path || !import_legacy_file(as, legacy_passwd_path)) {
+            LOG_ERR("Failed to create the account table %s", as->db_path);
+            acc_close(as);
+            return NULL;
+        }
+    }
+
+    if (!map_table(as) || !load_delta(as)) {
+        LOG_ERR("Failed to open the account store %s", path_prefix);
+        acc_close(as);
+        return NULL;
+    }
+
+    if (pthread_create(&as->writer_thread, NULL, writer_thread_main, as) != 0) {
+        LOG_ERR("Failed to spawn the account writer thread");
+        acc_close(as);
+        return NULL;
+    }
+    as->writer_started = true;
+
+    return as;
+}
+
+void acc_close(account_store_t *as)
+{
+    // The writer drains the queue before exiting, then the completions are
+    //  run here so that none of them outlives the store
+    if (as->writer_started) {
+        pthread_mutex_lock(&as->write_mutex);
+        as->writer_stop = true;
+        pthread_cond_signal(&as->write_cond);
+        pthread_mutex_unlock(&as->write_mutex);
+
+        pthread_join(as->writer_thread, NULL);
+        cq_dispatch();
+    }
+
+    if (as->compaction_state != cs_idle) {
+        pthread_join(as->compaction_thread, NULL);
+        free(as->compact_recs);
+    }
+
+    unmap_table(as);
+    if (as->delta_fd >= 0)
+        close(as->delta_fd);
+
+    for (int i = 0; i < as->delta_cnt; i++)
+        mem_free(as->delta[i]);
+    mem_free(as->delta);
+    hm_deinit(&as->delta_index);
+    hm_deinit(&as->pending_index);
+    rb_deinit(&as->write_queue);
+
+    pthread_cond_destroy(&as->write_cond);
+    pthread_mutex_destroy(&as->write_mutex);
+    pthread_mutex_destroy(&as->mutex);
+    mem_free(as);
+}
+
+static void *compaction_thread_main(void *data)
+{
+    account_store_t *as = data;
+
+    bool ok = write_table(as->db_tmp_path, as->map, as->compact_recs, as->compact_cnt, true);
+
+    pthread_mutex_lock(&as->mutex);
+    as->compaction_state = ok ? cs_done : cs_failed;
+    pthread_mutex_unlock(&as->mutex);
+
+    return NULL;
+}
+
+static void start_compaction(account_store_t *as)
+{
+    ASSERT(as->compaction_state == cs_idle);
+
+    as->compact_cnt = as->delta_cnt;
+    as->compact_recs = malloc(as->compact_cnt * sizeof(*as->compact_recs));
+    for (int i = 0; i < as->compact_cnt; i++)
+        as->compact_recs[i] = *as->delta[i];
+
+    as->compaction_state = cs_running;
+    if (pthread_create(&as->compaction_thread, NULL, compaction_thread_main, as) != 0) {
+        LOG_ERR("Failed to spawn the account compaction thread");
+        free(as->compact_recs);
+        as->compact_recs = NULL;
+        as->compaction_state = cs_idle;
+    }
+}
+
+static void finish_compaction(account_store_t *as)
+{
+    pthread_join(as->compaction_thread, NULL);
+    free(as->compact_recs);
+    as->compact_recs = NULL;
+
+    if (as->compaction_state == cs_failed) {
+        LOG_ERR("Account table compaction failed, will retry later");
+        unlink(as->db_tmp_path);
+        as->compaction_state = cs_idle;
+        return;
+    }
+
+    // If we crash after this rename, the snapshot records are both in the new
+    //  table and in the old delta, which is harmless
+    if (rename(as->db_tmp_path, as->db_path) != 0) {
+        LOG_ERR("Failed to swap in the compacted account table, will retry later");
+        unlink(as->db_tmp_path);
+        as->compaction_state = cs_idle;
+        return;
+    }
+    unmap_table(as);
+    ASSERTF(map_table(as), "Failed to map the compacted account table\n");
+
+    // The writer cuts the same records off the file: everything it has
+    //  committed so far comes after them, since the snapshot was taken from
+    //  the committed records
+    int snapshot_cnt = as->compact_cnt;
+    write_job_t *job = MEM_CALLOC(mt_accounts, NULL, 1, sizeof(*job));
+    job->type = wj_drop_prefix;
+    job->as = as;
+    job->drop_cnt = snapshot_cnt;
+    queue_write_job(as, job);
+
+    for (int i = 0; i < snapshot_cnt; i++) {
+        if (hm_get(&as->delta_index, as->delta[i]->usernm) == as->delta[i])
+            hm_remove(&as->delta_index, as->delta[i]->usernm);
+        mem_free(as->delta[i]);
+    }
+    memmove(as->delta, as->delta + snapshot_cnt,
+            (as->delta_cnt - snapshot_cnt) * sizeof(*as->delta));
+    as->delta_cnt -= snapshot_cnt;
+
+    as->compaction_state = cs_idle;
+}
+
+static int compact_threshold(account_store_t *as)
+{
+    uint64_t scaled = as->map ? as->map->h.num_records / ACC_COMPACT_FRACTION : 0;
+    if (scaled > ACC_COMPACT_MAX_DELTA)
+        scaled = ACC_COMPACT_MAX_DELTA;
+    return MAX(ACC_COMPACT_THRESHOLD, (int) scaled);
+}
+
+void acc_poll(account_store_t *as)
+{
+    if (as->compaction_state != cs_idle) {
+        pthread_mutex_lock(&as->mutex);
+        compaction_state_t state = as->compaction_state;
+        pthread_mutex_unlock(&as->mutex);
+
+        if (state != cs_running)
+            finish_compaction(as);
+    }
+
+    if (as->compaction_state == cs_idle && as->delta_cnt >= compact_threshold(as))
+        start_compaction(as);
+}
+
+const char *acc_lookup(account_store_t *as, const char *usernm)
+{
+    acc_poll(as);
+
+    acc_record_t *rec = hm_get(&as->delta_index, usernm);
+    if (!rec)
+        rec = table_find(as, usernm);
+
+    return rec ? rec->passwd : NULL;
+}
+
+bool acc_exists(account_store_t *as, const char *usernm)
+{
+    return acc_lookup(as, usernm) != NULL;
+}
+
+static void append_done(void *ctx, bool ok)
+{
+    write_job_t *job = ctx;
+    account_store_t *as = job->as;
+
+    hm_remove(&as->pending_index, job->rec.usernm);
+    if (ok)
+        delta_push(as, &job->rec);
+    else
+        LOG_ERR("Failed to append to the account delta file");
+
+    if (job->done_f)
+        (*job->done_f)(job->ctx, ok);
+    mem_free(job);
+
+    acc_poll(as);
+}
+
+static bool queue_append(account_store_t *as, const char *usernm, const char *passwd,
+                         bool must_exist, acc_add_done_func_t done_f, void *ctx)
+{
+    write_job_t *job = MEM_CALLOC(mt_accounts, NULL, 1, sizeof(*job));
+    if (
+            !fill_record(&job->rec, usernm, passwd) ||
+            hm_contains(&as->pending_index, usernm) ||
+            acc_exists(as, usernm) != must_exist
+       )
+    {
+        mem_free(job);
+        return false;
+    }
+
+    job->type = wj_append;
+    job->as = as;
+    job->done_f = done_f;
+    job->ctx = ctx;
+
+    hm_put(&as->pending_index, job->rec.usernm, job);
+    queue_write_job(as, job);
+    return true;
+}
+
+bool acc_add_async(account_store_t *as, const char *usernm, const char *passwd,
+                   acc_add_done_func_t done_f, void *ctx)
+{
+    return queue_append(as, usernm, passwd, false, done_f, ctx);
+}
+
+bool acc_set_passwd_async(account_store_t *as, const char *usernm, const char *passwd,
+                          acc_add_done_func_t done_f, void *ctx)
+{
+    return queue_append(as, usernm, passwd, true, done_f, ctx);
+}
@@ -0,0 +1,51 @@
+/* TextGameServer/account_store.h */
+#ifndef ACCOUNT_STORE_SENTRY
+#define ACCOUNT_STORE_SENTRY
+
+#include "defs.h"
+
+// Binary account storage. Accounts live in a memory-mapped open-addressing
+//  table file (<prefix>.db) plus an append-only delta file (<prefix>.delta)
+//  holding the accounts registered since the last compaction. Opening only
+//  validates the table header and loads the (bounded) delta, so startup does
+//  not depend on the number of accounts. Once the delta grows past a
+//  threshold, a background thread merges it into a new table file, which
+//  is swapped in by the owning thread on a later call.
+//
+// Registrations are appended by a background writer thread, which commits
+//  whatever has queued up with a single write and fdatasync (group commit) and
+//  reports back through the completion queue, so the owner never waits on disk.
+//
+// If the table does not exist yet, it is created from the legacy text
+//  password file ("<username> <password>" pairs), if one is given.
+
+#define ACC_USERNAME_MAX_LEN 64
+#define ACC_PASSWD_MAX_LEN   160
+
+typedef struct account_store_tag account_store_t;
+
+account_store_t *acc_open(const char *path_prefix, const char *legacy_passwd_path);
+void acc_close(account_store_t *as);
+
+// The returned string is only valid until the next call on the store
+const char *acc_lookup(account_store_t *as, const char *usernm);
+bool acc_exists(account_store_t *as, const char *usernm);
+
+typedef void (*acc_add_done_func_t)(void *ctx, bool ok);
+
+// Queues a new account for the writer thread. Fails right away if the user
+//  exists or is already being registered, or the credentials are too long.
+//  Otherwise done_f is called on the owner thread (from cq_dispatch) once the
+//  account is durable (ok) or the write has failed (!ok). The account is only
+//  visible to acc_lookup after a successful commit
+bool acc_add_async(account_store_t *as, const char *usernm, const char *passwd,
+                   acc_add_done_func_t done_f, void *ctx);
+// Same, but for an existing user: the new record shadows the old one
+bool acc_set_passwd_async(account_store_t *as, const char *usernm, const char *passwd,
+                          acc_add_done_func_t done_f, void *ctx);
+
+// Swaps in a finished background compaction, if any. Also called by every
+//  other acc_* function, so calling it is optional
+void acc_poll(account_store_t *as);
+
+#endif
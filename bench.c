@@ -0,0 +1,275 @@
+/* TextGameServer/bench.c */
+#include "defs.h"
+#include "utils.h"
+#include "chat_filter.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define HAND_SIZE       24
+#define HAND_ITERS      200000
+#define QUEUE_SIZE      1024
+#define QUEUE_ITERS     2000
+#define NUM_KEYS        4096
+#define LOOKUP_ITERS    200000
+#define NUM_PATTERNS    512
+#define NUM_MESSAGES    1024
+#define MESSAGE_LEN     96
+#define FILTER_ITERS    20
+
+static long get_nsec()
+{
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000000 + (long) ts.tv_nsec;
+}
+
+static void report(const char *name, long nsec, long ops)
+{
+    printf("%-40s %10.3lf ms  %8.2lf ns/op\n",
+           name, (double) nsec * 1e-6, (double) nsec / ops);
+}
+
+// Volatile sink so that the measured loops are not thrown away
+static volatile long sink = 0;
+
+static void bench_hands()
+{
+    static int cards[HAND_SIZE];
+    long start;
+
+    linked_list_t *list = ll_create();
+    for (int i = 0; i < HAND_SIZE; i++)
+        ll_push_front(list, &cards[i]);
+    start = get_nsec();
+    for (int it = 0; it < HAND_ITERS; it++) {
+        list_node_t *node = ll_find_at(list, it % HAND_SIZE);
+        sink += (long) node->data;
+    }
+    report("hand: ll_find_at", get_nsec() - start, HAND_ITERS);
+
+    small_vec_t vec;
+    svec_init(&vec);
+    for (int i = 0; i < HAND_SIZE; i++)
+        svec_push(&vec, &cards[i]);
+    start = get_nsec();
+    for (int it = 0; it < HAND_ITERS; it++)
+        sink += (long) svec_at(&vec, it % HAND_SIZE);
+    report("hand: svec_at", get_nsec() - start, HAND_ITERS);
+
+    // Play a random card and draw it back, as in a fool turn
+    start = get_nsec();
+    for (int it = 0; it < HAND_ITERS; it++) {
+        int idx = it % list->size;
+        list_node_t *node = ll_find_at(list, idx);
+        void *card = node->data;
+        ll_remove(list, node);
+        ll_push_front(list, card);
+    }
+    report("hand: ll play+draw", get_nsec() - start, HAND_ITERS);
+
+    start = get_nsec();
+    for (int it = 0; it < HAND_ITERS; it++) {
+        int idx = it % vec.size;
+        void *card = svec_at(&vec, idx);
+        svec_swap_remove(&vec, idx);
+        svec_push(&vec, card);
+    }
+    report("hand: svec play+draw", get_nsec() - start, HAND_ITERS);
+
+    ll_free(list);
+    svec_deinit(&vec);
+}
+
+static void bench_queues()
+{
+    long start;
+
+    linked_list_t *list = ll_create();
+    start = get_nsec();
+    for (int it = 0; it < QUEUE_ITERS; it++) {
+        for (int i = 0; i < QUEUE_SIZE; i++)
+            ll_push_front(list, (void *) (long) (i+1));
+        while (!ll_is_empty(list)) {
+            sink += (long) list->head->data;
+            ll_remove(list, list->head);
+        }
+    }
+    report("queue: linked list push/pop", get_nsec() - start, QUEUE_ITERS*QUEUE_SIZE);
+    ll_free(list);
+
+    ring_buf_t rb;
+    rb_init(&rb, 16);
+    start = get_nsec();
+    for (int it = 0; it < QUEUE_ITERS; it++) {
+        for (int i = 0; i < QUEUE_SIZE; i++)
+            rb_push_back(&rb, (void *) (long) (i+1));
+        while (!rb_is_empty(&rb))
+            sink += (long) rb_pop_front(&rb);
+    }
+    report("queue: ring buffer push/pop", get_nsec() - start, QUEUE_ITERS*QUEUE_SIZE);
+    rb_deinit(&rb);
+}
+
+static void bench_lookups()
+{
+    char **keys = malloc(NUM_KEYS * sizeof(*keys));
+    for (int i = 0; i < NUM_KEYS; i++) {
+        char buf[32];
+        sprintf(buf, "user%d", i);
+        keys[i] = strdup(buf);
+    }
+
+    long start;
+    int lookups = LOOKUP_ITERS / 64;
+
+    start = get_nsec();
+    for (int it = 0; it < lookups; it++) {
+        const char *query = keys[randint(0, NUM_KEYS-1)];
+        for (int i = 0; i < NUM_KEYS; i++) {
+            if (streq(keys[i], query)) {
+                sink += i;
+                break;
+            }
+        }
+    }
+    report("lookup: linear streq scan", get_nsec() - start, lookups);
+
+    hash_map_t hm;
+    hm_init(&hm, 16);
+    for (int i = 0; i < NUM_KEYS; i++)
+        hm_put(&hm, keys[i], keys[i]);
+
+    start = get_nsec();
+    for (int it = 0; it < LOOKUP_ITERS; it++)
+        sink += (long) hm_get(&hm, keys[randint(0, NUM_KEYS-1)]);
+    report("lookup: hash map", get_nsec() - start, LOOKUP_ITERS);
+
+    start = get_nsec();
+    for (int it = 0; it < LOOKUP_ITERS; it++) {
+        const char *key = keys[randint(0, NUM_KEYS-1)];
+        hm_remove(&hm, key);
+        hm_put(&hm, key, (void *) key);
+    }
+    report("lookup: hash map remove+put", get_nsec() - start, LOOKUP_ITERS);
+
+    hm_deinit(&hm);
+    for (int i = 0; i < NUM_KEYS; i++)
+        free(keys[i]);
+    free(keys);
+}
+
+static void random_word(char *dest, int min_len, int max_len)
+{
+    int len = randint(min_len, max_len);
+    for (int i = 0; i < len; i++)
+        dest[i] = 'a' + randint(0, 25);
+    dest[len] = '\0';
+}
+
+// What a chat_try_post_message with a strstr per pattern would do
+static int naive_scan(const char **patterns, const uint8_t *actions, int cnt,
+                      const char *msg, char *out, char *lowered)
+{
+    int found = 0;
+    size_t len = strlen(msg);
+    for (size_t i = 0; i <= len; i++) {
+        out[i] = msg[i];
+        lowered[i] = tolower((unsigned char) msg[i]);
+    }
+    for (int p = 0; p < cnt; p++) {
+        size_t plen = strlen(patterns[p]);
+        for (char *m = strstr(lowered, patterns[p]); m; m = strstr(m+1, patterns[p])) {
+            found |= actions[p];
+            if (actions[p] & cfa_mask)
+                memset(out + (m - lowered), '*', plen);
+        }
+    }
+    return found;
+}
+
+static void bench_filter()
+{
+    const char **patterns = malloc(NUM_PATTERNS * sizeof(*patterns));
+    uint8_t *actions = malloc(NUM_PATTERNS * sizeof(*actions));
+    for (int i = 0; i < NUM_PATTERNS; i++) {
+        char buf[16];
+        random_word(buf, 4, 8);
+        patterns[i] = strdup(buf);
+        actions[i] = i % 8 == 0 ? cfa_reject : (i % 8 == 1 ? cfa_flag : cfa_mask);
+    }
+
+    // Random words, with a pattern now and then
+    char **msgs = malloc(NUM_MESSAGES * sizeof(*msgs));
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        char buf[MESSAGE_LEN+16];
+        int len = 0;
+        while (len < MESSAGE_LEN) {
+            if (randint(0, 15) == 0)
+                len += sprintf(buf + len, "%s ", patterns[randint(0, NUM_PATTERNS-1)]);
+            else {
+                random_word(buf + len, 2, 7);
+                len += strlen(buf + len);
+                buf[len++] = ' ';
+            }
+        }
+        buf[MESSAGE_LEN] = '\0';
+        msgs[i] = strdup(buf);
+    }
+
+    char out[MESSAGE_LEN+1], lowered[MESSAGE_LEN+1];
+    long start;
+    int ops = FILTER_ITERS * NUM_MESSAGES;
+
+    start = get_nsec();
+    for (int it = 0; it < FILTER_ITERS; it++) {
+        for (int i = 0; i < NUM_MESSAGES; i++)
+            sink += naive_scan(patterns, actions, NUM_PATTERNS, msgs[i], out, lowered);
+    }
+    report("filter: strstr per pattern", get_nsec() - start, ops);
+
+    start = get_nsec();
+    chat_filter_t *cf = cf_compile(patterns, actions, NUM_PATTERNS);
+    report("filter: aho-corasick compile", get_nsec() - start, 1);
+
+    start = get_nsec();
+    for (int it = 0; it < FILTER_ITERS; it++) {
+        for (int i = 0; i < NUM_MESSAGES; i++)
+            sink += cf_scan(cf, msgs[i], out);
+    }
+    report("filter: aho-corasick scan", get_nsec() - start, ops);
+
+    printf("filter: %d states x %d classes, %zu table bytes\n",
+           cf->states_cnt, cf->classes_cnt,
+           (size_t) cf->states_cnt * cf->classes_cnt * sizeof(*cf->next));
+
+    // Both must find and mask the same
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        char naive_out[MESSAGE_LEN+1];
+        int naive_found = naive_scan(patterns, actions, NUM_PATTERNS, msgs[i], naive_out, lowered);
+        ASSERTF(cf_scan(cf, msgs[i], out) == naive_found && streq(out, naive_out),
+                "Filter mismatch on \"%s\"\n", msgs[i]);
+    }
+
+    cf_free(cf);
+    for (int i = 0; i < NUM_PATTERNS; i++)
+        free((char *) patterns[i]);
+    for (int i = 0; i < NUM_MESSAGES; i++)
+        free(msgs[i]);
+    free(patterns);
+    free(actions);
+    free(msgs);
+}
+
+int main()
+{
+    srand(time(NULL));
+
+    bench_hands();
+    bench_queues();
+    bench_lookups();
+    bench_filter();
+
+    return 0;
+}
@@ -2,16 +2,29 @@
 
 DEFINES=""
 CFLAGS="$DEFINES -g -Wall"
-LFLAGS="-lpthread"
+LFLAGS="-lpthread -lcrypt"
 
 gcc $CFLAGS -c utils.c
+gcc $CFLAGS -c mem_stats.c
+gcc $CFLAGS -c usernames.c
+gcc $CFLAGS -c completion_queue.c
+gcc $CFLAGS -c worker_pool.c
+gcc $CFLAGS -c passwd_hash.c
+gcc $CFLAGS -c account_store.c
 gcc $CFLAGS -c logic.c
+gcc $CFLAGS -c room_registry.c
+gcc $CFLAGS -c matchmaking.c
+gcc $CFLAGS -c room_list.c
+gcc $CFLAGS -c presence.c
 gcc $CFLAGS -c hub.c
 gcc $CFLAGS -c fool.c
 gcc $CFLAGS -c sudoku.c
 gcc $CFLAGS -c sudoku_board.c
 gcc $CFLAGS -c sudoku_generator.c
+gcc $CFLAGS -c chat_filter.c
 gcc $CFLAGS -c chat.c
-gcc $CFLAGS server.c utils.o logic.o hub.o fool.o sudoku.o sudoku_board.o sudoku_generator.o chat.o $LFLAGS -o server
+gcc $CFLAGS -c commands.c
+gcc $CFLAGS server.c utils.o mem_stats.o usernames.o completion_queue.o worker_pool.o passwd_hash.o account_store.o logic.o room_registry.o matchmaking.o room_list.o presence.o hub.o fool.o sudoku.o sudoku_board.o sudoku_generator.o chat_filter.o chat.o commands.o $LFLAGS -o server
 
-gcc $CFLAGS test.c sudoku_board.o sudoku_generator.o -o test
+gcc $CFLAGS test.c sudoku_board.o sudoku_generator.o commands.o logic.o chat.o chat_filter.o presence.o usernames.o worker_pool.o completion_queue.o mem_stats.o utils.o $LFLAGS -o test
+gcc $CFLAGS bench.c utils.o chat_filter.o -o bench
@@ -2,84 +2,943 @@
 #include "chat.h"
 #include "chat_funcs.h"
 #include "utils.h"
+#include "usernames.h"
+#include "worker_pool.h"
+#include "presence.h"
+#include "chat_filter.h"
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
-#define MAX_CHAT_MSG_LEN 64
+#define CHAT_RING_MAGIC     "TGSCHT1"
 
-chat_t *make_chat()
+#define INIT_BATCH_SIZE     256
+#define INIT_PENDING_SIZE   8
+#define INIT_SUBS_SIZE      8
+#define INIT_CHANNELS_SIZE  16
+#define SUBS_PER_SLAB       64
+
+// A background msync of a mapped ring. If the chat is destroyed meanwhile,
+//  the job unmaps the ring once done
+typedef struct chat_sync_job_tag {
+    chat_t *chat;
+    void *addr;
+    size_t size;
+} chat_sync_job_t;
+
+// Chats with pending messages, the ones backed by files, and the channels by name
+static small_vec_t dirty_chats;
+static small_vec_t persistent_chats;
+static hash_map_t channels;
+static bool chat_lists_inited = false;
+
+static mem_pool_t sub_pool = MEM_POOL_INITIALIZER(chat_sub_t, SUBS_PER_SLAB);
+
+// Whispers find their addressees here, NULL until the hub sets it
+static presence_t *presence_ref = NULL;
+
+// Applied to every posted message, NULL if there is none. Reloads compile
+//  the file on a worker, and the result replaces the filter on completion
+typedef struct chat_filter_job_tag {
+    const char *requester;  // Interned handle, holds a ref
+    chat_filter_t *result;
+} chat_filter_job_t;
+
+static chat_filter_t *filter = NULL;
+static const char *filter_path = NULL;
+static bool filter_reloading = false;
+
+// Filtered copy of the message being posted
+static char *scratch = NULL;
+static size_t scratch_cap = 0;
+
+static void set_ring(chat_t *c, void *block)
 {
-    chat_t *c = malloc(sizeof(*c));
-    c->head = 0;
-    c->tail = 0;
-    for (int i = 0; i < CHAT_MSG_HISTORY_SIZE; i++) {
-        c->history[i].username = NULL;
-        c->history[i].content = NULL;
-        c->history[i].used = false;
+    c->ring = block;
+    c->slots = (chat_slot_t *) ((char *) block + sizeof(*c->ring));
+    c->arena = (char *) (c->slots + c->history_size);
+}
+
+static void init_ring(chat_t *c)
+{
+    memset(c->ring, 0, sizeof(*c->ring));
+    memcpy(c->ring->h.magic, CHAT_RING_MAGIC, sizeof(CHAT_RING_MAGIC));
+    c->ring->h.history_size = c->history_size;
+    c->ring->h.msg_max_len = c->msg_max_len;
+}
+
+static chat_t *alloc_chat(server_room_t *s_room, int history_size, int msg_max_len,
+                          mem_counters_t *owner)
+{
+    if (!chat_lists_inited) {
+        svec_init(&dirty_chats);
+        svec_init(&persistent_chats);
+        hm_init(&channels, INIT_CHANNELS_SIZE);
+        chat_lists_inited = true;
     }
 
+    chat_t *c = MEM_ALLOC(mt_chat, owner, sizeof(*c));
+    c->owner = owner;
+    c->room = s_room;
+    c->name = NULL;
+    c->kept = false;
+
+    c->subs_cnt = 0;
+    c->subs_cap = INIT_SUBS_SIZE;
+    c->subs = MEM_ALLOC(mt_chat, owner, c->subs_cap * sizeof(*c->subs));
+
+    c->history_size = history_size;
+    c->msg_max_len = msg_max_len;
+    c->ring_size = sizeof(chat_ring_header_t) +
+                   (size_t) c->history_size * (sizeof(chat_slot_t) + c->msg_max_len+1);
+    set_ring(c, MEM_ALLOC(mt_chat, owner, c->ring_size));
+    init_ring(c);
+
+    c->mapped = false;
+    c->unsynced = false;
+    c->last_sync = 0;
+    c->sync_job = NULL;
+
+    c->batch_len = 0;
+    c->batch_cap = INIT_BATCH_SIZE;
+    c->batch = MEM_ALLOC(mt_chat, owner, c->batch_cap);
+    c->pending_cnt = 0;
+    c->pending_cap = INIT_PENDING_SIZE;
+    c->pending = MEM_ALLOC(mt_chat, owner, c->pending_cap * sizeof(*c->pending));
+    c->pending_since = 0;
+    c->dirty_idx = -1;
+
     return c;
 }
 
+chat_t *make_chat(server_room_t *s_room, mem_counters_t *owner)
+{
+    const room_preset_t *preset = s_room->preset;
+    return alloc_chat(s_room,
+                      preset->chat_history_size > 0 ?
+                          preset->chat_history_size : CHAT_DEFAULT_HISTORY_SIZE,
+                      preset->chat_msg_max_len > 0 ?
+                          preset->chat_msg_max_len : CHAT_DEFAULT_MSG_MAX_LEN,
+                      owner);
+}
+
+static void unmark_dirty(chat_t *c);
+static void clear_pending(chat_t *c);
+
 void destroy_chat(chat_t *c)
 {
-    for (int i = 0; i < CHAT_MSG_HISTORY_SIZE; i++) {
-        if (c->history[i].username)
-            free(c->history[i].username);
-        if (c->history[i].content)
-            free(c->history[i].content);
+    // Subscribers from other rooms, if the chat is public
+    while (c->subs_cnt > 0)
+        chat_unsubscribe(c->subs[c->subs_cnt-1]);
+    mem_free(c->subs);
+    if (c->name) {
+        hm_remove(&channels, c->name);
+        mem_free(c->name);
+    }
+
+    unmark_dirty(c);
+    clear_pending(c);
+    mem_free(c->batch);
+    mem_free(c->pending);
+
+    if (!c->mapped)
+        mem_free(c->ring);
+    else {
+        svec_swap_remove(&persistent_chats, svec_find(&persistent_chats, c));
+        // The page cache still gets the writes to the file after munmap
+        if (c->sync_job)
+            c->sync_job->chat = NULL;
+        else
+            munmap(c->ring, c->ring_size);
     }
-    free(c);
+    mem_free(c);
 }
 
-bool chat_try_post_message(chat_t *c, server_room_t *s_room,
-                           room_session_t *author_rs, const char *msg)
+static bool ring_is_valid(chat_t *c, chat_ring_header_t *ring)
 {
-    ASSERT(author_rs->is_in_chat);
+    if (memcmp(ring->h.magic, CHAT_RING_MAGIC, sizeof(CHAT_RING_MAGIC)) != 0 ||
+        ring->h.history_size != c->history_size || ring->h.msg_max_len != c->msg_max_len ||
+        ring->h.head >= c->history_size || ring->h.cnt > c->history_size ||
+        ring->h.last_seq < ring->h.cnt)
+    {
+        return false;
+    }
+
+    chat_slot_t *slots = (chat_slot_t *) ((char *) ring + sizeof(*ring));
+    char *arena = (char *) (slots + c->history_size);
+    for (uint32_t i = 0; i < ring->h.cnt; i++) {
+        int idx = (ring->h.head + i) % c->history_size;
+        chat_slot_t *slot = &slots[idx];
+        if (slot->len > c->msg_max_len || slot->username[CHAT_USERNAME_MAX_LEN] != '\0' ||
+            slot->seq != ring->h.last_seq - ring->h.cnt + 1 + i ||
+            arena[(size_t) idx * (c->msg_max_len+1) + slot->len] != '\0')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
 
-    if (strlen(msg) > MAX_CHAT_MSG_LEN)
+bool chat_persist(chat_t *c, const char *path)
+{
+    ASSERT(!c->mapped);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERR("Can not open the chat history file %s", path);
         return false;
+    }
+
+    struct stat st;
+    bool reuse = fstat(fd, &st) == 0 && st.st_size == c->ring_size;
+    if (!reuse && ftruncate(fd, c->ring_size) != 0) {
+        LOG_ERR("Can not resize the chat history file %s", path);
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, c->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERR("Can not map the chat history file %s", path);
+        return false;
+    }
+
+    if (!reuse || !ring_is_valid(c, map)) {
+        memcpy(map, c->ring, c->ring_size);
+        c->unsynced = true;
+    }
+
+    mem_free(c->ring);
+    set_ring(c, map);
+    c->mapped = true;
+    svec_push(&persistent_chats, c);
+    return true;
+}
+
+void chat_publish(chat_t *c, const char *name)
+{
+    ASSERT(!c->name && !hm_contains(&channels, name));
+    c->name = MEM_STRDUP(mt_chat, c->owner, name);
+    hm_put(&channels, c->name, c);
+}
+
+chat_t *chat_open_channel(const char *name)
+{
+    chat_t *c = alloc_chat(NULL, CHAT_DEFAULT_HISTORY_SIZE, CHAT_DEFAULT_MSG_MAX_LEN, NULL);
+    chat_publish(c, name);
+    c->kept = true;
+    return c;
+}
+
+chat_sub_t *chat_subscribe(chat_t *c, room_session_t *r_sess)
+{
+    chat_sub_t *sub = pool_alloc(&sub_pool);
+    sub->chat = c;
+    sub->r_sess = r_sess;
+    sub->interf = r_sess->interf;
+    sub->seen = 0;
+
+    if (c->subs_cnt >= c->subs_cap) {
+        c->subs_cap *= 2;
+        c->subs = MEM_REALLOC(c->subs, c->subs_cap * sizeof(*c->subs));
+    }
+    sub->idx = c->subs_cnt;
+    c->subs[c->subs_cnt++] = sub;
+    return sub;
+}
+
+void chat_unsubscribe(chat_sub_t *sub)
+{
+    chat_t *c = sub->chat;
+    ASSERT(c->subs[sub->idx] == sub);
+
+    // The last subscriber takes the place
+    chat_sub_t *moved = c->subs[--c->subs_cnt];
+    c->subs[sub->idx] = moved;
+    moved->idx = sub->idx;
+
+    if (sub->r_sess && sub->r_sess->room_sub == sub)
+        sub->r_sess->room_sub = NULL;
+    else {
+        session_interface_t *interf = sub->interf;
+        for (int i = 0; i < interf->channel_subs_cnt; i++) {
+            if (interf->channel_subs[i] == sub) {
+                interf->channel_subs[i] = interf->channel_subs[--interf->channel_subs_cnt];
+                break;
+            }
+        }
+    }
+    pool_free(&sub_pool, sub);
 
-    if (c->history[c->head].used && c->tail == c->head)
-        inc_cycl(&c->head, CHAT_MSG_HISTORY_SIZE);
+    // Standalone channels go away with their last subscriber
+    if (!c->room && !c->kept && c->subs_cnt == 0)
+        destroy_chat(c);
+}
+
+// A channel that is the room's own chat is kept for the next rooms, but
+//  goes quiet while here, as the room sub already delivers its lines
+static inline bool sub_is_dormant(chat_sub_t *sub)
+{
+    room_session_t *r_sess = sub->r_sess;
+    return r_sess && sub != r_sess->room_sub && sub->chat == r_sess->room_sub->chat;
+}
+
+void chat_bind_channels(room_session_t *r_sess)
+{
+    session_interface_t *interf = r_sess->interf;
+    for (int i = 0; i < interf->channel_subs_cnt; i++) {
+        chat_sub_t *sub = interf->channel_subs[i];
+        sub->r_sess = r_sess;
+        if (sub_is_dormant(sub) && sub->seen > r_sess->room_sub->seen)
+            r_sess->room_sub->seen = sub->seen;
+    }
+}
+
+void chat_unbind_channels(room_session_t *r_sess)
+{
+    session_interface_t *interf = r_sess->interf;
+    for (int i = 0; i < interf->channel_subs_cnt; i++) {
+        chat_sub_t *sub = interf->channel_subs[i];
+        if (sub_is_dormant(sub) && r_sess->room_sub->seen > sub->seen)
+            sub->seen = r_sess->room_sub->seen;
+        sub->r_sess = NULL;
+    }
+}
+
+void chat_leave_channels(session_interface_t *interf)
+{
+    while (interf->channel_subs_cnt > 0)
+        chat_unsubscribe(interf->channel_subs[interf->channel_subs_cnt-1]);
+}
+
+static inline char *slot_text(chat_t *c, int idx)
+{
+    return c->arena + (size_t) idx * (c->msg_max_len+1);
+}
+
+static void mark_dirty(chat_t *c)
+{
+    if (c->dirty_idx >= 0)
+        return;
+    c->dirty_idx = dirty_chats.size;
+    svec_push(&dirty_chats, c);
+}
+
+static void unmark_dirty(chat_t *c)
+{
+    if (c->dirty_idx < 0)
+        return;
+
+    int idx = c->dirty_idx;
+    svec_swap_remove(&dirty_chats, idx);
+    chat_t *moved = svec_at(&dirty_chats, idx);
+    if (moved)
+        moved->dirty_idx = idx;
+    c->dirty_idx = -1;
+}
+
+static void queue_pending(chat_t *c, const char *author, long seq, const char *msg)
+{
+    int len = strlen(author) + strlen(msg) + 4; // ": " and "\r\n"
+    if (c->batch_len + len + 1 > c->batch_cap) {
+        while (c->batch_len + len + 1 > c->batch_cap)
+            c->batch_cap *= 2;
+        c->batch = MEM_REALLOC(c->batch, c->batch_cap);
+    }
+    if (c->pending_cnt >= c->pending_cap) {
+        c->pending_cap *= 2;
+        c->pending = MEM_REALLOC(c->pending, c->pending_cap * sizeof(*c->pending));
+    }
+
+    chat_pending_t *p = &c->pending[c->pending_cnt++];
+    p->author = uname_retain(author);
+    p->seq = seq;
+    p->start = c->batch_len;
+    p->len = sprintf(c->batch + c->batch_len, "%s: %s\r\n", author, msg);
+    c->batch_len += p->len;
+
+    if (c->pending_cnt == 1)
+        c->pending_since = -1; // Stamped by the next flush
+    mark_dirty(c);
+}
+
+static void clear_pending(chat_t *c)
+{
+    for (int i = 0; i < c->pending_cnt; i++)
+        uname_release(c->pending[i].author);
+    c->pending_cnt = 0;
+    c->batch_len = 0;
+}
+
+static void append_line(room_session_t *r_sess, chat_t *c, bool prefixed,
+                        const char *line, int len)
+{
+    if (prefixed) {
+        outbuf_append(r_sess->interf, "[#", 2);
+        outbuf_append(r_sess->interf, c->name, strlen(c->name));
+        outbuf_append(r_sess->interf, "] ", 2);
+    }
+    outbuf_append(r_sess->interf, line, len);
+}
+
+// Costs O(subscribers), lines go to the ones in chat mode
+static void deliver_pending(chat_t *c)
+{
+    for (int i = 0; i < c->subs_cnt; i++) {
+        chat_sub_t *sub = c->subs[i];
+        room_session_t *r_sess = sub->r_sess;
+        if (!r_sess || !r_sess->is_in_chat || sub_is_dormant(sub))
+            continue;
+
+        // Members of other rooms see where the lines come from
+        bool prefixed = sub != r_sess->room_sub;
+
+        // Lines may already have been sent with chat_send_updates
+        bool skip_some = prefixed || sub->seen >= c->pending[0].seq;
+        for (int j = 0; j < c->pending_cnt && !skip_some; j++)
+            skip_some = uname_eq(c->pending[j].author, r_sess->username);
+
+        if (!skip_some)
+            outbuf_append(r_sess->interf, c->batch, c->batch_len);
+        else {
+            // The member has written or seen some of the lines, or needs prefixes
+            for (int j = 0; j < c->pending_cnt; j++) {
+                chat_pending_t *p = &c->pending[j];
+                if (p->seq > sub->seen && !uname_eq(p->author, r_sess->username))
+                    append_line(r_sess, c, prefixed, c->batch + p->start, p->len);
+            }
+        }
+        sub->seen = c->pending[c->pending_cnt-1].seq;
+    }
+
+    clear_pending(c);
+}
+
+static bool sync_work(void *ctx)
+{
+    chat_sync_job_t *job = ctx;
+    return msync(job->addr, job->size, MS_SYNC) == 0;
+}
+
+static void sync_done(void *ctx, bool ok)
+{
+    chat_sync_job_t *job = ctx;
+    if (!ok)
+        LOG_ERR("Failed to sync the chat history file");
+
+    if (job->chat)
+        job->chat->sync_job = NULL;
+    else
+        munmap(job->addr, job->size);
+    mem_free(job);
+}
+
+// Returns the msec until the sync is due, -1 if there is nothing to sync
+static long try_sync(chat_t *c, long now_msec)
+{
+    if (!c->unsynced || c->sync_job)
+        return -1;
+
+    long due = c->last_sync + CHAT_SYNC_MSEC;
+    if (due > now_msec)
+        return due - now_msec;
+
+    // Not charged to the room: the job may outlive it
+    chat_sync_job_t *job = MEM_ALLOC(mt_chat, NULL, sizeof(*job));
+    job->chat = c;
+    job->addr = c->ring;
+    job->size = c->ring_size;
+    if (!wp_submit(&sync_work, &sync_done, job)) {
+        mem_free(job);
+        return CHAT_SYNC_MSEC; // Busy, retry later
+    }
+
+    c->sync_job = job;
+    c->unsynced = false;
+    c->last_sync = now_msec;
+    return -1;
+}
+
+long chat_flush_pending(long now_msec)
+{
+    if (!chat_lists_inited)
+        return -1;
+
+    long next = -1;
+    for (int i = 0; i < persistent_chats.size; i++) {
+        long left = try_sync(svec_at(&persistent_chats, i), now_msec);
+        if (left >= 0 && (next < 0 || left < next))
+            next = left;
+    }
 
-    c->history[c->tail].username = strdup(author_rs->username);
-    c->history[c->tail].content = strdup(msg);
-    c->history[c->tail].used = true;
+    for (int i = 0; i < dirty_chats.size; ) {
+        chat_t *c = svec_at(&dirty_chats, i);
+        if (c->pending_since < 0)
+            c->pending_since = now_msec;
 
-    inc_cycl(&c->tail, CHAT_MSG_HISTORY_SIZE);
+        long due = c->pending_since + CHAT_DIGEST_MSEC;
+        if (c->subs_cnt >= CHAT_DIGEST_MIN_MEMBERS && due > now_msec) {
+            if (next < 0 || due - now_msec < next)
+                next = due - now_msec;
+            i++;
+            continue;
+        }
 
-    for (int i = 0; i < s_room->sess_cnt; i++) {
-        room_session_t *r_sess = s_room->sess_refs[i];
-        if (r_sess->is_in_chat && r_sess != author_rs)
-            OUTBUF_POSTF(r_sess, "%s: %s\r\n", author_rs->username, msg);
+        deliver_pending(c);
+        unmark_dirty(c); // The last chat takes this place
     }
 
+    return next;
+}
+
+void chat_flood_init(chat_flood_t *fl)
+{
+    fl->credit = CHAT_FLOOD_BURST * CHAT_FLOOD_MSEC;
+    fl->refilled = get_msec();
+    for (int i = 0; i < CHAT_DUP_HISTORY; i++) {
+        fl->recent_hashes[i] = 0;
+        fl->recent_times[i] = -CHAT_DUP_WINDOW_MSEC;
+    }
+    fl->recent_next = 0;
+}
+
+static chat_post_result_t check_flood(chat_flood_t *fl, const char *msg, long now_msec)
+{
+    fl->credit += now_msec - fl->refilled;
+    fl->refilled = now_msec;
+    if (fl->credit > CHAT_FLOOD_BURST * CHAT_FLOOD_MSEC)
+        fl->credit = CHAT_FLOOD_BURST * CHAT_FLOOD_MSEC;
+    if (fl->credit < CHAT_FLOOD_MSEC)
+        return cpr_flood;
+
+    unsigned int hash = hash_str(msg);
+    for (int i = 0; i < CHAT_DUP_HISTORY; i++) {
+        if (fl->recent_hashes[i] == hash &&
+            now_msec - fl->recent_times[i] < CHAT_DUP_WINDOW_MSEC)
+        {
+            return cpr_duplicate;
+        }
+    }
+
+    return cpr_ok;
+}
+
+// Only posts that went through are charged and remembered
+static void charge_flood(chat_flood_t *fl, const char *msg, long now_msec)
+{
+    fl->credit -= CHAT_FLOOD_MSEC;
+    fl->recent_hashes[fl->recent_next] = hash_str(msg);
+    fl->recent_times[fl->recent_next] = now_msec;
+    fl->recent_next = (fl->recent_next + 1) % CHAT_DUP_HISTORY;
+}
+
+static void ensure_scratch(size_t size)
+{
+    if (size <= scratch_cap)
+        return;
+    if (scratch) mem_free(scratch);
+    scratch_cap = size;
+    scratch = MEM_ALLOC(mt_chat, NULL, scratch_cap);
+}
+
+// Flagged lines go to the results log. c is NULL for whispers
+static void log_flagged(room_session_t *author_rs, chat_t *c, const char *to,
+                        const char *msg)
+{
+    FILE *f = author_rs->room->logs_file_handle;
+    if (c && c->name)
+        fprintf(f, "CHAT: flagged, #%s, %s: %s\n", c->name, author_rs->username, msg);
+    else if (c)
+        fprintf(f, "CHAT: flagged, room %s, %s: %s\n", c->room->name, author_rs->username, msg);
+    else
+        fprintf(f, "CHAT: flagged, whisper to %s, %s: %s\n", to, author_rs->username, msg);
+    fflush(f);
+}
+
+// On success, *out is msg with the matches masked (in the scratch buffer,
+//  valid until the next message)
+static chat_post_result_t filter_message(room_session_t *author_rs, chat_t *c,
+                                         const char *to, const char *msg, const char **out)
+{
+    *out = msg;
+    if (!filter)
+        return cpr_ok;
+
+    ensure_scratch(strlen(msg)+1);
+    int found = cf_scan(filter, msg, scratch);
+    if (found & cfa_reject)
+        return cpr_rejected;
+    if (found & cfa_flag)
+        log_flagged(author_rs, c, to, msg);
+    *out = scratch;
+    return cpr_ok;
+}
+
+chat_post_result_t chat_try_post_message(chat_t *c, server_room_t *s_room,
+                                         room_session_t *author_rs, const char *msg)
+{
+    ASSERT(author_rs->is_in_chat);
+
+    size_t len = strlen(msg);
+    if (len > (size_t) c->msg_max_len)
+        return cpr_too_long;
+
+    chat_flood_t *fl = &author_rs->interf->chat_flood;
+    long now_msec = get_msec();
+    chat_post_result_t res = check_flood(fl, msg, now_msec);
+    if (res != cpr_ok)
+        return res;
+
+    const char *filtered;
+    res = filter_message(author_rs, c, NULL, msg, &filtered);
+    if (res != cpr_ok)
+        return res;
+    charge_flood(fl, msg, now_msec);
+    msg = filtered;
+
+    // The slot is written before the ring header, which publishes it.
+    //  When full, the oldest slot is reclaimed
+    chat_ring_header_t *ring = c->ring;
+    int idx = (ring->h.head + ring->h.cnt) % c->history_size;
+
+    chat_slot_t *slot = &c->slots[idx];
+    slot->seq = ring->h.last_seq + 1;
+    slot->len = len;
+    strncpy(slot->username, author_rs->username, CHAT_USERNAME_MAX_LEN);
+    slot->username[CHAT_USERNAME_MAX_LEN] = '\0';
+    memcpy(slot_text(c, idx), msg, len+1);
+
+    if (ring->h.cnt == c->history_size)
+        ring->h.head = (ring->h.head + 1) % c->history_size;
+    else
+        ring->h.cnt++;
+    ring->h.last_seq++;
+    c->unsynced = c->mapped;
+
+    queue_pending(c, author_rs->username, ring->h.last_seq, msg);
+    return cpr_ok;
+}
+
+const char *chat_post_result_text(chat_post_result_t res)
+{
+    switch (res) {
+        case cpr_ok:
+            return "";
+        case cpr_too_long:
+            return "The message is too long!\r\n";
+        case cpr_rejected:
+            return "The message contains words that are not allowed here\r\n";
+        case cpr_flood:
+            return "You are sending messages too fast, slow down\r\n";
+        case cpr_duplicate:
+            return "You have just said that\r\n";
+    }
+    return "";
+}
+
+void chat_init_filter(const char *path)
+{
+    filter_path = path;
+    // Not having a filter file is fine, having a broken one is logged
+    if (access(path, F_OK) == 0)
+        filter = cf_load(path);
+}
+
+// Worker thread
+static bool filter_load_work(void *ctx)
+{
+    chat_filter_job_t *job = ctx;
+    job->result = cf_load(filter_path);
+    return job->result != NULL;
+}
+
+static void filter_load_done(void *ctx, bool ok)
+{
+    chat_filter_job_t *job = ctx;
+    if (ok) {
+        if (filter) cf_free(filter);
+        filter = job->result;
+    }
+    filter_reloading = false;
+
+    presence_entry_t *entry = presence_ref ? pres_find(presence_ref, job->requester) : NULL;
+    if (entry && entry->r_sess && entry->r_sess->is_in_chat) {
+        char msg[128];
+        if (ok)
+            sprintf(msg, "The chat filter has been reloaded, %d patterns\r\n", filter->patterns_cnt);
+        else
+            sprintf(msg, "Failed to reload the chat filter, the old one stays\r\n");
+        outbuf_append(entry->r_sess->interf, msg, strlen(msg));
+    }
+
+    uname_release(job->requester);
+    mem_free(job);
+}
+
+bool chat_reload_filter(room_session_t *requester)
+{
+    if (!filter_path || filter_reloading)
+        return false;
+
+    chat_filter_job_t *job = MEM_ALLOC(mt_chat, NULL, sizeof(*job));
+    job->requester = uname_retain(requester->username);
+    job->result = NULL;
+    if (!wp_submit(&filter_load_work, &filter_load_done, job)) {
+        uname_release(job->requester);
+        mem_free(job);
+        return false;
+    }
+
+    filter_reloading = true;
     return true;
 }
 
-void chat_send_updates(chat_t *c, room_session_t *r_sess, const char *header)
+static void add_messages(string_builder_t *sb, chat_sub_t *sub, long after_seq)
+{
+    chat_t *c = sub->chat;
+    room_session_t *r_sess = sub->r_sess;
+    bool prefixed = sub != r_sess->room_sub;
+
+    // Seqs of the slots are consecutive, so the unseen ones are a suffix
+    chat_ring_header_t *ring = c->ring;
+    long unseen = (long) ring->h.last_seq - after_seq;
+    int first = unseen < ring->h.cnt ? ring->h.cnt - unseen : 0;
+    for (int i = first; i < ring->h.cnt; i++) {
+        int idx = (ring->h.head + i) % c->history_size;
+        chat_slot_t *slot = &c->slots[idx];
+
+        if (prefixed)
+            sb_add_strf(sb, "[#%s] ", c->name);
+        if (streq(r_sess->username, slot->username))
+            sb_add_strf(sb, "%s\r\n", slot_text(c, idx));
+        else
+            sb_add_strf(sb, "%s: %s\r\n", slot->username, slot_text(c, idx));
+    }
+    sub->seen = ring->h.last_seq;
+}
+
+static void send_messages(room_session_t *r_sess, const char *header, bool full)
 {
     ASSERT(r_sess->is_in_chat);
 
     string_builder_t *sb = sb_create();
-    sb_add_str(sb, clrscr);
+    if (full)
+        sb_add_str(sb, clrscr);
     if (header)
         sb_add_str(sb, header);
 
-    int msg_idx = c->head;
-    for (int i = 0; i < CHAT_MSG_HISTORY_SIZE; i++) {
-        chat_message_t *msg = &c->history[msg_idx];
-        if (!msg->used)
-            break;
+    session_interface_t *interf = r_sess->interf;
+    add_messages(sb, r_sess->room_sub, full ? 0 : r_sess->room_sub->seen);
+    for (int i = 0; i < interf->channel_subs_cnt; i++) {
+        chat_sub_t *sub = interf->channel_subs[i];
+        if (!sub_is_dormant(sub))
+            add_messages(sb, sub, full ? 0 : sub->seen);
+    }
 
-        if (streq(r_sess->username, msg->username))
-            sb_add_strf(sb, "%s\r\n", msg->content);
-        else
-            sb_add_strf(sb, "%s: %s\r\n", msg->username, msg->content);
+    OUTBUF_POST_SB(r_sess, sb);
+    sb_free(sb);
+}
 
-        inc_cycl(&msg_idx, CHAT_MSG_HISTORY_SIZE);
+void chat_send_updates(room_session_t *r_sess, const char *header)
+{
+    send_messages(r_sess, header, false);
+}
+
+void chat_send_history(room_session_t *r_sess, const char *header)
+{
+    send_messages(r_sess, header, true);
+}
+
+static bool channel_name_is_valid(const char *name)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len > CHAT_CHANNEL_NAME_MAX_LEN)
+        return false;
+    for (const char *p = name; *p; p++) {
+        if (!isalnum((unsigned char) *p) && *p != '_' && *p != '-')
+            return false;
+    }
+    return true;
+}
+
+static chat_sub_t *find_channel_sub(session_interface_t *interf, const char *name)
+{
+    for (int i = 0; i < interf->channel_subs_cnt; i++) {
+        if (streq(interf->channel_subs[i]->chat->name, name))
+            return interf->channel_subs[i];
+    }
+    return NULL;
+}
+
+static void join_channel(room_session_t *r_sess, const char *name)
+{
+    session_interface_t *interf = r_sess->interf;
+    if (!channel_name_is_valid(name)) {
+        OUTBUF_POSTF(r_sess, "Channel names are up to %d letters, digits, _ or -\r\n",
+                     CHAT_CHANNEL_NAME_MAX_LEN);
+        return;
+    }
+
+    chat_t *c = hm_get(&channels, name);
+    if (find_channel_sub(interf, name)) {
+        OUTBUF_POSTF(r_sess, "You are already in #%s\r\n", name);
+        return;
+    } else if (interf->channel_subs_cnt >= CHAT_MAX_CHANNELS) {
+        OUTBUF_POSTF(r_sess, "You can not be in more than %d channels\r\n", CHAT_MAX_CHANNELS);
+        return;
+    }
+
+    if (!c) {
+        c = alloc_chat(NULL, CHAT_DEFAULT_HISTORY_SIZE, CHAT_DEFAULT_MSG_MAX_LEN, NULL);
+        chat_publish(c, name);
+    }
+
+    // Only new lines, the history is there for the history command
+    chat_sub_t *sub = chat_subscribe(c, r_sess);
+    sub->seen = c->ring->h.last_seq;
+    interf->channel_subs[interf->channel_subs_cnt++] = sub;
+    if (sub_is_dormant(sub))
+        OUTBUF_POSTF(r_sess, "Joined #%s, it will follow you into games\r\n", name);
+    else
+        OUTBUF_POSTF(r_sess, "Joined #%s\r\n", name);
+}
+
+static void leave_channel(room_session_t *r_sess, const char *name)
+{
+    chat_sub_t *sub = find_channel_sub(r_sess->interf, name);
+    if (!sub) {
+        OUTBUF_POSTF(r_sess, "You are not in #%s\r\n", name);
+        return;
+    }
+
+    chat_unsubscribe(sub);
+    OUTBUF_POSTF(r_sess, "Left #%s\r\n", name);
+}
+
+// Users kept in a room's chat as a channel are counted once
+static int count_members(chat_t *c)
+{
+    int cnt = 0;
+    for (int i = 0; i < c->subs_cnt; i++)
+        cnt += !sub_is_dormant(c->subs[i]);
+    return cnt;
+}
+
+static void send_channels_list(room_session_t *r_sess)
+{
+    session_interface_t *interf = r_sess->interf;
+    chat_t *room_chat = r_sess->room_sub->chat;
+
+    bool joined = false;
+    for (int i = 0; i < interf->channel_subs_cnt; i++)
+        joined = joined || sub_is_dormant(interf->channel_subs[i]);
+
+    string_builder_t *sb = sb_create();
+    if (room_chat->name)
+        sb_add_strf(sb, "#%s (this room%s, %d)\r\n", room_chat->name,
+                    joined ? ", joined" : "", count_members(room_chat));
+    else
+        sb_add_strf(sb, "This room's chat (%d)\r\n", room_chat->subs_cnt);
+    for (int i = 0; i < interf->channel_subs_cnt; i++) {
+        chat_sub_t *sub = interf->channel_subs[i];
+        if (!sub_is_dormant(sub))
+            sb_add_strf(sb, "#%s (%d)\r\n", sub->chat->name, count_members(sub->chat));
     }
 
     OUTBUF_POST_SB(r_sess, sb);
     sb_free(sb);
 }
+
+void chat_set_presence(presence_t *pres)
+{
+    presence_ref = pres;
+}
+
+// Goes straight into the addressee's output, as it is not kept anywhere
+static void whisper(room_session_t *r_sess, const char *args)
+{
+    char name[CHAT_USERNAME_MAX_LEN+1];
+    const char *sep = strchr(args, ' ');
+    size_t name_len = sep ? (size_t) (sep - args) : 0;
+    if (!sep || name_len == 0 || name_len > CHAT_USERNAME_MAX_LEN || !sep[1]) {
+        OUTBUF_POST(r_sess, "Usage: /w <user> <message>\r\n");
+        return;
+    }
+    memcpy(name, args, name_len);
+    name[name_len] = '\0';
+    const char *msg = sep+1;
+
+    // Whispers draw on the same flood budget as posts
+    chat_flood_t *fl = &r_sess->interf->chat_flood;
+    long now_msec = get_msec();
+    chat_post_result_t res;
+    const char *filtered;
+
+    presence_entry_t *entry = presence_ref ? pres_find(presence_ref, name) : NULL;
+    room_session_t *to = entry ? entry->r_sess : NULL;
+    if (!entry)
+        OUTBUF_POSTF(r_sess, "%s is not online\r\n", name);
+    else if (uname_eq(entry->username, r_sess->username))
+        OUTBUF_POST(r_sess, "You can not whisper to yourself\r\n");
+    else if (strlen(msg) > (size_t) r_sess->room_sub->chat->msg_max_len)
+        OUTBUF_POST(r_sess, "The message is too long!\r\n");
+    else if (entry->state != pst_online || !to || !to->is_in_chat)
+        OUTBUF_POSTF(r_sess, "%s is not in a chat right now, try later\r\n", name);
+    else if (
+            (res = check_flood(fl, msg, now_msec)) != cpr_ok ||
+            (res = filter_message(r_sess, NULL, entry->username, msg, &filtered)) != cpr_ok
+            )
+    {
+        OUTBUF_POST(r_sess, chat_post_result_text(res));
+    } else {
+        charge_flood(fl, msg, now_msec);
+        msg = filtered;
+
+        outbuf_appendf(to->interf, "[whisper] %s: %s\r\n", r_sess->username, msg);
+
+        OUTBUF_POSTF(r_sess, "[whisper to %s] %s\r\n", entry->username, msg);
+    }
+}
+
+bool chat_try_process_command(room_session_t *r_sess, const char *line)
+{
+    ASSERT(r_sess->is_in_chat);
+
+    if (strncmp(line, "/join ", 6) == 0)
+        join_channel(r_sess, line+6);
+    else if (strncmp(line, "/leave ", 7) == 0)
+        leave_channel(r_sess, line+7);
+    else if (streq(line, "/channels"))
+        send_channels_list(r_sess);
+    else if (strncmp(line, "/w ", 3) == 0)
+        whisper(r_sess, line+3);
+    else if (line[0] == '#') {
+        char name[CHAT_CHANNEL_NAME_MAX_LEN+1];
+        const char *sep = strchr(line, ' ');
+        size_t name_len = sep ? (size_t) (sep - line - 1) : 0;
+        if (!sep || name_len == 0 || name_len > CHAT_CHANNEL_NAME_MAX_LEN)
+            return false;
+        memcpy(name, line+1, name_len);
+        name[name_len] = '\0';
+
+        chat_t *room_chat = r_sess->room_sub->chat;
+        chat_sub_t *sub = find_channel_sub(r_sess->interf, name);
+        chat_t *c = sub ? sub->chat :
+                    (room_chat->name && streq(room_chat->name, name) ? room_chat : NULL);
+        if (!c)
+            OUTBUF_POSTF(r_sess, "You are not in #%s, /join it first\r\n", name);
+        else {
+            chat_post_result_t res = chat_try_post_message(c, c->room, r_sess, sep+1);
+            if (res != cpr_ok)
+                OUTBUF_POST(r_sess, chat_post_result_text(res));
+        }
+    } else
+        return false;
+
+    return true;
+}
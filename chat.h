@@ -3,18 +3,117 @@
 #define CHAT_SENTRY
 
 #include "defs.h"
+#include "mem_stats.h"
+#include <stdint.h>
 
-#define CHAT_MSG_HISTORY_SIZE 16
+// Defaults for presets that do not set their own history depth and message length
+#define CHAT_DEFAULT_HISTORY_SIZE   16
+#define CHAT_DEFAULT_MSG_MAX_LEN    64
+#define CHAT_USERNAME_MAX_LEN       64
 
-typedef struct chat_message_tag {
-    char *username;
-    char *content;
-    bool used;
-} chat_message_t;
+// Chats of big rooms hold deliveries for a while to batch more messages
+#define CHAT_DIGEST_MIN_MEMBERS 256
+#define CHAT_DIGEST_MSEC        100
+
+// Persistent chats are msynced at most this often
+#define CHAT_SYNC_MSEC          1000
+
+// Flood control: a user's posting credit refills by one message per
+//  CHAT_FLOOD_MSEC and holds up to CHAT_FLOOD_BURST of them, and a message
+//  identical to one of the last CHAT_DUP_HISTORY within CHAT_DUP_WINDOW_MSEC
+//  is refused
+#define CHAT_FLOOD_MSEC         1000
+#define CHAT_FLOOD_BURST        5
+#define CHAT_DUP_HISTORY        4
+#define CHAT_DUP_WINDOW_MSEC    30000
+
+// Channels a session can join on top of its room chat
+#define CHAT_MAX_CHANNELS       4
+#define CHAT_CHANNEL_NAME_MAX_LEN 16
+
+// History is a ring of slots in one block, allocated once with the chat:
+//  the ring header, the slot headers, and an arena holding msg_max_len+1
+//  bytes of text per slot. Posting overwrites the oldest slot when the ring
+//  is full, so it never allocates. The block holds no pointers, so it can
+//  also be a mapped file (see chat_persist).
+//
+// Messages are numbered from 1 in posting order, so that a session only
+//  needs the last number it has seen to be sent what it has missed
+typedef union chat_ring_header_tag {
+    struct {
+        char magic[8];
+        uint32_t history_size;
+        uint32_t msg_max_len;
+        uint64_t last_seq;  // 0 if nothing has been posted
+        uint32_t head, cnt; // Oldest slot and the number of used ones
+    } h;
+    char pad[64];
+} chat_ring_header_t;
+
+typedef struct chat_slot_tag {
+    uint64_t seq;
+    uint32_t len;
+    char username[CHAT_USERNAME_MAX_LEN+1];
+} chat_slot_t;
+
+// A subscription to a chat. Every room session is subscribed to its room
+//  chat for its whole stay. On top of that, a user may join named channels
+//  (other rooms' chats made public, like the hub's "global", or standalone
+//  ones), which stay with the session interface across room switches.
+//  Lines are delivered to the subscribers that are in chat mode
+typedef struct chat_sub_tag {
+    struct chat_tag *chat;
+    struct room_session_tag *r_sess;          // NULL while between rooms
+    struct session_interface_tag *interf;
+    long seen;      // Seq of the last message sent to the subscriber
+    int idx;        // In chat->subs
+} chat_sub_t;
+
+// Per user, kept in the session interface across rooms. Checked before the
+//  message is filtered or formatted, so a refused post costs O(1)
+typedef struct chat_flood_tag {
+    long credit;            // msec worth of refill, CHAT_FLOOD_MSEC per post
+    long refilled;          // msec
+    unsigned int recent_hashes[CHAT_DUP_HISTORY];
+    long recent_times[CHAT_DUP_HISTORY];
+    int recent_next;
+} chat_flood_t;
+
+// Messages posted since the last flush, formatted into one batch text
+typedef struct chat_pending_tag {
+    const char *author; // Interned handle, holds a ref
+    long seq;
+    int start, len;     // Of the line in the batch
+} chat_pending_t;
 
 typedef struct chat_tag {
-    chat_message_t history[CHAT_MSG_HISTORY_SIZE];
-    int head, tail;
+    chat_ring_header_t *ring;
+    chat_slot_t *slots;
+    char *arena;
+    size_t ring_size;
+    int history_size, msg_max_len;
+
+    // Set if the ring is a mapped file
+    bool mapped;
+    bool unsynced;
+    long last_sync;         // msec
+    struct chat_sync_job_tag *sync_job;
+
+    struct server_room_tag *room; // NULL for standalone channels
+    char *name;             // Channel name, NULL if the chat is not public
+    bool kept;              // Standalone, but stays when nobody is in it
+
+    chat_sub_t **subs;
+    int subs_cnt, subs_cap;
+
+    char *batch;
+    int batch_len, batch_cap;
+    chat_pending_t *pending;
+    int pending_cnt, pending_cap;
+    long pending_since;     // Of the first pending message, msec
+    int dirty_idx;          // In the list of chats to flush, -1 if not there
+
+    mem_counters_t *owner;
 } chat_t;
 
 #endif
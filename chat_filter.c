@@ -0,0 +1,217 @@
+/* TextGameServer/chat_filter.c */
+#include "chat_filter.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define INIT_PATTERNS_SIZE  32
+#define LINE_BUF_SIZE       (CF_PATTERN_MAX_LEN + 16)
+
+static int assign_classes(uint8_t *class_of, const char **patterns, int cnt)
+{
+    int classes_cnt = 1;
+    memset(class_of, 0, 256);
+    for (int i = 0; i < cnt; i++) {
+        for (const char *p = patterns[i]; *p; p++) {
+            int b = tolower((unsigned char) *p);
+            if (!class_of[b])
+                class_of[b] = classes_cnt++;
+        }
+    }
+
+    // Folding: upper case letters share the classes of lower case ones
+    for (int b = 0; b < 256; b++) {
+        if (isupper(b))
+            class_of[b] = class_of[tolower(b)];
+    }
+    return classes_cnt;
+}
+
+static void add_to_trie(chat_filter_t *cf, const char *pattern, uint8_t action)
+{
+    int state = 0;
+    size_t len = 0;
+    for (const char *p = pattern; *p; p++, len++) {
+        uint16_t *cell = &cf->next[state * cf->classes_cnt + cf->class_of[(unsigned char) *p]];
+        if (!*cell)
+            *cell = cf->states_cnt++;
+        state = *cell;
+    }
+
+    cf->actions[state] |= action;
+    if ((action & cfa_mask) && len > cf->mask_len[state])
+        cf->mask_len[state] = len;
+}
+
+// BFS from the root: a state's failure target is shallower, so its row is
+//  complete by the time the state is reached, and missing transitions are
+//  copied from there
+static void fold_failure_links(chat_filter_t *cf)
+{
+    int *queue = malloc(cf->states_cnt * sizeof(*queue));
+    int *fail = malloc(cf->states_cnt * sizeof(*fail));
+    int head = 0, tail = 0;
+    int classes_cnt = cf->classes_cnt;
+
+    for (int c = 0; c < classes_cnt; c++) {
+        int t = cf->next[c];
+        if (t) {
+            fail[t] = 0;
+            queue[tail++] = t;
+        }
+    }
+
+    while (head < tail) {
+        int s = queue[head++];
+        uint16_t *row = &cf->next[s * classes_cnt];
+        uint16_t *fail_row = &cf->next[fail[s] * classes_cnt];
+
+        // Patterns ending at the failure target are suffixes of the ones here
+        cf->actions[s] |= cf->actions[fail[s]];
+        if (cf->mask_len[fail[s]] > cf->mask_len[s])
+            cf->mask_len[s] = cf->mask_len[fail[s]];
+
+        for (int c = 0; c < classes_cnt; c++) {
+            if (row[c]) {
+                fail[row[c]] = fail_row[c];
+                queue[tail++] = row[c];
+            } else
+                row[c] = fail_row[c];
+        }
+    }
+
+    free(queue);
+    free(fail);
+}
+
+chat_filter_t *cf_compile(const char **patterns, const uint8_t *actions, int cnt)
+{
+    size_t max_states = 1;
+    for (int i = 0; i < cnt; i++) {
+        size_t len = strlen(patterns[i]);
+        if (len == 0 || len > CF_PATTERN_MAX_LEN) {
+            LOG_ERR("Filter pattern %d is empty or longer than %d", i+1, CF_PATTERN_MAX_LEN);
+            return NULL;
+        }
+        max_states += len;
+    }
+    if (max_states > CF_MAX_STATES) {
+        LOG_ERR("Filter patterns are too long in total");
+        return NULL;
+    }
+
+    uint8_t class_of[256];
+    int classes_cnt = assign_classes(class_of, patterns, cnt);
+
+    // The tables follow the header in the same block
+    size_t table_size = max_states * classes_cnt * sizeof(uint16_t);
+    chat_filter_t *cf = calloc(1, sizeof(*cf) + table_size + 2*max_states);
+    memcpy(cf->class_of, class_of, sizeof(class_of));
+    cf->classes_cnt = classes_cnt;
+    cf->states_cnt = 1;
+    cf->patterns_cnt = cnt;
+    cf->next = (uint16_t *) (cf + 1);
+    cf->actions = (uint8_t *) cf->next + table_size;
+    cf->mask_len = cf->actions + max_states;
+
+    for (int i = 0; i < cnt; i++)
+        add_to_trie(cf, patterns[i], actions[i]);
+    fold_failure_links(cf);
+
+    return cf;
+}
+
+static bool parse_action(const char *word, uint8_t *action)
+{
+    if (streq(word, "mask"))
+        *action = cfa_mask;
+    else if (streq(word, "reject"))
+        *action = cfa_reject;
+    else if (streq(word, "flag"))
+        *action = cfa_flag;
+    else
+        return false;
+    return true;
+}
+
+chat_filter_t *cf_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        LOG_ERR("Failed to open the chat filter file %s", path);
+        return NULL;
+    }
+
+    int cnt = 0, cap = INIT_PATTERNS_SIZE;
+    char **patterns = malloc(cap * sizeof(*patterns));
+    uint8_t *actions = malloc(cap * sizeof(*actions));
+    bool ok = true;
+
+    char line[LINE_BUF_SIZE];
+    for (int line_num = 1; ok && fgets(line, sizeof(line), f); line_num++) {
+        size_t len = strlen(line);
+        if (len == sizeof(line)-1 && line[len-1] != '\n' && !feof(f)) {
+            LOG_ERR("%s:%d: the line is too long", path, line_num);
+            ok = false;
+            break;
+        }
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        char *sep = strchr(line, ' ');
+        uint8_t action;
+        if (sep)
+            *sep = '\0';
+        if (!sep || !sep[1] || !parse_action(line, &action)) {
+            LOG_ERR("%s:%d: expected <mask|reject|flag> <pattern>", path, line_num);
+            ok = false;
+            break;
+        }
+
+        if (cnt >= cap) {
+            cap *= 2;
+            patterns = realloc(patterns, cap * sizeof(*patterns));
+            actions = realloc(actions, cap * sizeof(*actions));
+        }
+        patterns[cnt] = strdup(sep+1);
+        actions[cnt] = action;
+        cnt++;
+    }
+    fclose(f);
+
+    chat_filter_t *cf = ok ? cf_compile((const char **) patterns, actions, cnt) : NULL;
+
+    for (int i = 0; i < cnt; i++)
+        free(patterns[i]);
+    free(patterns);
+    free(actions);
+    return cf;
+}
+
+void cf_free(chat_filter_t *cf)
+{
+    free(cf);
+}
+
+int cf_scan(const chat_filter_t *cf, const char *msg, char *out)
+{
+    int found = 0;
+    int state = 0;
+    int i = 0;
+    for (; msg[i]; i++) {
+        out[i] = msg[i];
+        state = cf->next[state * cf->classes_cnt + cf->class_of[(unsigned char) msg[i]]];
+        found |= cf->actions[state];
+
+        // Only the bytes up to here are touched, the scan goes on over msg
+        int mask_len = cf->mask_len[state];
+        if (mask_len)
+            memset(out + i+1 - mask_len, '*', mask_len);
+    }
+    out[i] = '\0';
+
+    return found;
+}
@@ -0,0 +1,52 @@
+/* TextGameServer/chat_filter.h */
+#ifndef CHAT_FILTER_SENTRY
+#define CHAT_FILTER_SENTRY
+
+#include "defs.h"
+#include <stdint.h>
+
+// Banned word filter for chat messages. The pattern list is compiled into an
+//  Aho-Corasick automaton with the failure links folded into a full
+//  transition table, so a message is scanned in one pass with one table
+//  lookup per byte, however many patterns there are. Matching ignores case.
+//
+// To keep the table small, bytes are first mapped to symbol classes: one
+//  per distinct (case-folded) byte used in the patterns, and class 0 for
+//  all the others. The table is one block of states x classes 16-bit
+//  entries, next to per-state action bits and mask lengths.
+//
+// Pattern files have one "<action> <pattern>" per line, with actions being
+//  mask, reject and flag. Empty lines and lines starting with # are skipped.
+//
+// Plain malloc is used throughout, so filters can be compiled on workers.
+
+#define CF_PATTERN_MAX_LEN  64
+#define CF_MAX_STATES       65535
+
+typedef enum cf_action_tag {
+    cfa_mask   = 1 << 0,    // Replace the match with asterisks
+    cfa_reject = 1 << 1,    // Refuse the whole message
+    cfa_flag   = 1 << 2     // Let it through, but log it
+} cf_action_t;
+
+typedef struct chat_filter_tag {
+    uint8_t class_of[256];
+    int classes_cnt;
+    int states_cnt;
+    int patterns_cnt;
+
+    uint16_t *next;     // Row per state, column per class
+    uint8_t *actions;   // Of the patterns ending in the state, suffixes included
+    uint8_t *mask_len;  // Longest masked pattern ending in the state, 0 if none
+} chat_filter_t;
+
+// Return NULL on invalid input (and log why)
+chat_filter_t *cf_compile(const char **patterns, const uint8_t *actions, int cnt);
+chat_filter_t *cf_load(const char *path);
+void cf_free(chat_filter_t *cf);
+
+// Copies msg to out (which must fit it), masking as it goes. Returns the
+//  actions of all the patterns found, 0 if there were none
+int cf_scan(const chat_filter_t *cf, const char *msg, char *out);
+
+#endif
@@ -5,10 +5,77 @@
 #include "chat.h"
 #include "logic.h"
 
-chat_t *make_chat();
+chat_t *make_chat(server_room_t *s_room, mem_counters_t *owner);
 void destroy_chat(chat_t *c);
-bool chat_try_post_message(chat_t *c, server_room_t *s_room,
-                           room_session_t *author_rs, const char *msg);
-void chat_send_updates(chat_t *c, room_session_t *r_sess, const char *header);
+
+typedef enum chat_post_result_tag {
+    cpr_ok,
+    cpr_too_long,
+    cpr_rejected,       // By the filter
+    cpr_flood,
+    cpr_duplicate
+} chat_post_result_t;
+
+// The message is only queued, the server delivers it with chat_flush_pending
+chat_post_result_t chat_try_post_message(chat_t *c, server_room_t *s_room,
+                                         room_session_t *author_rs, const char *msg);
+// What to tell the author if the post has failed
+const char *chat_post_result_text(chat_post_result_t res);
+
+// Full credit, no recent messages (see chat_flood_t)
+void chat_flood_init(chat_flood_t *fl);
+
+// Banned words (see chat_filter.h). The filter at path, if there is a file,
+//  is loaded at once. A reload compiles the file in the background and
+//  tells the requester how it went; it fails if one is already running
+void chat_init_filter(const char *path);
+bool chat_reload_filter(room_session_t *requester);
+// The header followed by the messages the session has not seen yet, from
+//  the room chat and then from every joined channel (prefixed with its name)
+void chat_send_updates(room_session_t *r_sess, const char *header);
+// A full replay on a clear screen
+void chat_send_history(room_session_t *r_sess, const char *header);
+
+// Registers the chat as a channel others can join by name
+void chat_publish(chat_t *c, const char *name);
+// A standalone channel that is there even with no one in it, destroyed
+//  with destroy_chat by whoever has opened it
+chat_t *chat_open_channel(const char *name);
+
+// Room sessions subscribe to their room chat with these (see logic.c).
+//  The last unsubscribe from a standalone channel destroys it
+chat_sub_t *chat_subscribe(chat_t *c, room_session_t *r_sess);
+void chat_unsubscribe(chat_sub_t *sub);
+
+// The joined channels of the interface follow it from room session to room
+//  session: bound when one is made, unbound before it is destroyed
+void chat_bind_channels(room_session_t *r_sess);
+void chat_unbind_channels(room_session_t *r_sess);
+void chat_leave_channels(session_interface_t *interf);
+
+// For whispers, which look the addressee up by name
+void chat_set_presence(struct presence_tag *pres);
+
+// Commands available in chat mode: /join <name>, /leave <name>, /channels,
+//  #<name> <msg> and /w <user> <msg>. Joining an unknown name creates a
+//  standalone channel. Whispers only reach users who are in a chat.
+//  Returns false if the line is not one of those
+bool chat_try_process_command(room_session_t *r_sess, const char *line);
+
+// Moves the history into a ring file at path, mapped shared. If the file
+//  holds a valid ring of the same dimensions, its history replaces the
+//  current one, otherwise the file is (re)created from the current history.
+//  Posts then only touch the page cache, the file is msynced in the
+//  background every CHAT_SYNC_MSEC. On failure the chat stays in memory
+bool chat_persist(chat_t *c, const char *path);
+
+// Called by the server once per loop iteration. Every chat with queued
+//  messages appends them as one batch to the output of every in-chat
+//  subscriber (minus their own lines), so the cost is per subscriber, not
+//  per user online. Chats with CHAT_DIGEST_MIN_MEMBERS or more subscribers
+//  hold their batch for up to CHAT_DIGEST_MSEC. Also starts
+//  the msync of persistent chats that are due. Returns the msec until the
+//  next held batch or sync is due, -1 if there are none
+long chat_flush_pending(long now_msec);
 
 #endif
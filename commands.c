@@ -0,0 +1,167 @@
+/* TextGameServer/commands.c */
+#include "commands.h"
+#include "mem_stats.h"
+#include "utils.h"
+#include <string.h>
+
+static int assign_classes(uint8_t *class_of, const command_t *cmds, int cnt)
+{
+    int classes_cnt = 1;
+    memset(class_of, 0, 256);
+    for (int i = 0; i < cnt; i++) {
+        for (const char *p = cmds[i].name; *p; p++) {
+            if (!class_of[(unsigned char) *p])
+                class_of[(unsigned char) *p] = classes_cnt++;
+        }
+    }
+    return classes_cnt;
+}
+
+static void add_to_trie(command_table_t *t, int idx)
+{
+    int state = 0;
+    for (const char *p = t->cmds[idx].name; *p; p++) {
+        uint16_t *cell = &t->next[state * t->classes_cnt + t->class_of[(unsigned char) *p]];
+        if (!*cell)
+            *cell = t->states_cnt++;
+        state = *cell;
+    }
+
+    ASSERTF(!t->cmd_of[state], "Command %s is declared twice\n", t->cmds[idx].name);
+    t->cmd_of[state] = idx+1;
+}
+
+void cmdt_init(command_table_t *t, const command_t *cmds, int cnt)
+{
+    size_t max_states = 1;
+    for (int i = 0; i < cnt; i++) {
+        const char *name = cmds[i].name;
+        ASSERTF(*name && !strchr(name, ' '), "Invalid command name \"%s\"\n", name);
+        max_states += strlen(name);
+    }
+    ASSERTF(max_states <= CMD_MAX_STATES, "Command names are too long in total\n");
+
+    t->cmds = cmds;
+    t->cmds_cnt = cnt;
+    t->classes_cnt = assign_classes(t->class_of, cmds, cnt);
+    t->states_cnt = 1;
+
+    // Both tables in one block, they live as long as the server
+    size_t table_size = max_states * t->classes_cnt;
+    t->next = MEM_CALLOC(mt_logic, NULL, table_size + max_states, sizeof(uint16_t));
+    t->cmd_of = t->next + table_size;
+
+    for (int i = 0; i < cnt; i++)
+        add_to_trie(t, i);
+}
+
+const command_t *cmdt_find(const command_table_t *t, const char *line, const char **args)
+{
+    int state = 0;
+    const char *p = line;
+    for (; *p && *p != ' '; p++) {
+        state = t->next[state * t->classes_cnt + t->class_of[(unsigned char) *p]];
+        if (!state)
+            return NULL;
+    }
+
+    int idx = t->cmd_of[state];
+    if (!idx)
+        return NULL;
+
+    const command_t *cmd = &t->cmds[idx-1];
+    if (*p == ' ') {
+        if (cmd->args == ca_none)
+            return NULL;
+        p++;
+    } else if (cmd->args == ca_required)
+        return NULL;
+
+    *args = p;
+    return cmd;
+}
+
+bool cmdt_dispatch(const command_table_t *t, room_session_t *r_sess, const char *line)
+{
+    const char *args;
+    const command_t *cmd = cmdt_find(t, line, &args);
+    return cmd && (*cmd->func)(r_sess, args);
+}
+
+bool tok_char(cmd_tokenizer_t *tok, char c)
+{
+    if (*tok->pos != c)
+        return false;
+    tok->pos++;
+    return true;
+}
+
+bool tok_spaces(cmd_tokenizer_t *tok)
+{
+    if (*tok->pos != ' ')
+        return false;
+    while (*tok->pos == ' ')
+        tok->pos++;
+    return true;
+}
+
+bool tok_at_end(cmd_tokenizer_t *tok)
+{
+    while (*tok->pos == ' ')
+        tok->pos++;
+    return !*tok->pos;
+}
+
+bool tok_word(cmd_tokenizer_t *tok, char *buf, size_t size)
+{
+    if (tok_at_end(tok))
+        return false;
+
+    size_t len = strcspn(tok->pos, " ");
+    if (len >= size)
+        return false;
+    memcpy(buf, tok->pos, len);
+    buf[len] = '\0';
+    tok->pos += len;
+    return true;
+}
+
+bool tok_letter(cmd_tokenizer_t *tok, int *idx)
+{
+    char c = *tok->pos;
+    if (c >= 'a' && c <= 'z')
+        *idx = c - 'a';
+    else if (c >= 'A' && c <= 'Z')
+        *idx = c - 'A';
+    else
+        return false;
+    tok->pos++;
+    return true;
+}
+
+bool tok_digit(cmd_tokenizer_t *tok, int *out)
+{
+    if (*tok->pos < '0' || *tok->pos > '9')
+        return false;
+    *out = *tok->pos++ - '0';
+    return true;
+}
+
+bool tok_uint(cmd_tokenizer_t *tok, int max, int *out)
+{
+    const char *p = tok->pos;
+    int val = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        // Checked before multiplying, so that val never overflows
+        int digit = *p - '0';
+        if (val > max / 10 || val*10 > max - digit)
+            return false;
+        val = val*10 + digit;
+    }
+    if (p == tok->pos)
+        return false;
+
+    tok->pos = p;
+    *out = val;
+    return true;
+}
@@ -0,0 +1,85 @@
+/* TextGameServer/commands.h */
+#ifndef COMMANDS_SENTRY
+#define COMMANDS_SENTRY
+
+#include "defs.h"
+#include "logic.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Word commands of the room presets. Each preset keeps a static table of
+//  commands and compiles it into a trie once, in its init_subs_f, so that
+//  finding the command for a line costs one table lookup per byte of the
+//  command word, however many commands there are. As in the chat filter,
+//  bytes are mapped to symbol classes first (class 0 for the bytes not used
+//  in any name), and a byte of class 0 ends the walk right away.
+//
+// The command word is everything up to the first space, and the arguments
+//  are whatever follows that space. Matching is case sensitive.
+
+#define CMD_MAX_STATES 65535
+
+typedef enum cmd_args_tag {
+    ca_none,        // Only the bare word
+    ca_optional,    // The word, or the word, a space and arguments
+    ca_required     // The word, a space and (possibly empty) arguments
+} cmd_args_t;
+
+// Return false if the command does not apply in the current state, so that
+//  the line is processed as if it were not a command
+typedef bool (*command_func_t)(room_session_t *r_sess, const char *args);
+
+typedef struct command_tag {
+    const char *name;
+    cmd_args_t args;
+    command_func_t func;
+} command_t;
+
+typedef struct command_table_tag {
+    const command_t *cmds;
+    int cmds_cnt;
+
+    uint8_t class_of[256];
+    int classes_cnt;
+    int states_cnt;
+
+    uint16_t *next;     // Row per state, column per class, 0 if no edge
+    uint16_t *cmd_of;   // Index+1 of the command ending in the state, 0 if none
+} command_table_t;
+
+void cmdt_init(command_table_t *t, const command_t *cmds, int cnt);
+
+// Returns NULL if the line is not a command of the table. Otherwise sets
+//  *args to the arguments ("" if there are none)
+const command_t *cmdt_find(const command_table_t *t, const char *line, const char **args);
+
+// Finds the command and runs it, false if there was none or it declined
+bool cmdt_dispatch(const command_table_t *t, room_session_t *r_sess, const char *line);
+
+// Hand-written scanner for command arguments. All the functions return false
+//  if the input does not match, and the position is unspecified then
+typedef struct cmd_tokenizer_tag {
+    const char *pos;
+} cmd_tokenizer_t;
+
+static inline void tok_init(cmd_tokenizer_t *tok, const char *str)
+{
+    tok->pos = str;
+}
+
+// Exactly the char c
+bool tok_char(cmd_tokenizer_t *tok, char c);
+// One or more spaces
+bool tok_spaces(cmd_tokenizer_t *tok);
+// Nothing but spaces left
+bool tok_at_end(cmd_tokenizer_t *tok);
+// Skips spaces, then copies the word up to the next space into buf
+bool tok_word(cmd_tokenizer_t *tok, char *buf, size_t size);
+// One latin letter of any case, *idx is its index in the alphabet
+bool tok_letter(cmd_tokenizer_t *tok, int *idx);
+// A single decimal digit
+bool tok_digit(cmd_tokenizer_t *tok, int *out);
+// Decimal digits, up to max (inclusive), which may be as large as INT_MAX
+bool tok_uint(cmd_tokenizer_t *tok, int max, int *out);
+
+#endif
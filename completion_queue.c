@@ -0,0 +1,76 @@
+/* TextGameServer/completion_queue.c */
+#include "completion_queue.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define INIT_QUEUE_SIZE 64
+
+typedef struct completion_tag {
+    completion_func_t func;
+    void *ctx;
+    bool ok;
+} completion_t;
+
+static ring_buf_t queue                = { 0 };
+static pthread_mutex_t queue_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static int wakeup_pipe[2]              = { -1, -1 };
+
+void cq_init()
+{
+    if (wakeup_pipe[0] >= 0)
+        return;
+
+    rb_init(&queue, INIT_QUEUE_SIZE);
+    ASSERT_ERR(pipe(wakeup_pipe) == 0);
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(wakeup_pipe[i], F_GETFL);
+        fcntl(wakeup_pipe[i], F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
+int cq_fd()
+{
+    return wakeup_pipe[0];
+}
+
+void cq_post(completion_func_t func, void *ctx, bool ok)
+{
+    completion_t *c = malloc(sizeof(*c));
+    c->func = func;
+    c->ctx = ctx;
+    c->ok = ok;
+
+    pthread_mutex_lock(&queue_mutex);
+    bool was_empty = rb_is_empty(&queue);
+    rb_push_back(&queue, c);
+    pthread_mutex_unlock(&queue_mutex);
+
+    // One byte per batch is enough, the loop drains the whole queue. If the
+    //  pipe is full the loop is already due to wake up, so EAGAIN is fine
+    if (was_empty) {
+        char b = 0;
+        write(wakeup_pipe[1], &b, 1);
+    }
+}
+
+void cq_dispatch()
+{
+    char buf[64];
+    while (read(wakeup_pipe[0], buf, sizeof(buf)) > 0)
+        NOOP;
+
+    for (;;) {
+        pthread_mutex_lock(&queue_mutex);
+        completion_t *c = rb_pop_front(&queue);
+        pthread_mutex_unlock(&queue_mutex);
+
+        if (!c)
+            break;
+
+        (*c->func)(c->ctx, c->ok);
+        free(c);
+    }
+}
@@ -0,0 +1,21 @@
+/* TextGameServer/completion_queue.h */
+#ifndef COMPLETION_QUEUE_SENTRY
+#define COMPLETION_QUEUE_SENTRY
+
+#include "defs.h"
+
+// Hands results of background work back to the event loop thread.
+//  Worker threads cq_post a callback, which wakes the loop through a pipe
+//  (cq_fd is part of the select set), and the loop runs all posted callbacks
+//  in posting order with cq_dispatch.
+
+typedef void (*completion_func_t)(void *ctx, bool ok);
+
+void cq_init();
+int cq_fd();
+// Thread-safe
+void cq_post(completion_func_t func, void *ctx, bool ok);
+// Event loop thread only
+void cq_dispatch();
+
+#endif
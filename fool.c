@@ -3,6 +3,7 @@
 #include "logic.h"
 #include "chat_funcs.h"
 #include "utils.h"
+#include "commands.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -12,7 +13,7 @@
 
 typedef struct fool_session_data_tag {
     player_state_t state;
-    linked_list_t *hand;
+    small_vec_t hand;
     bool can_attack;
 } fool_session_data_t;
 
@@ -30,9 +31,18 @@ typedef struct fool_room_data_tag {
     server_room_t *hub_ref;
 } fool_room_data_t;
 
+#define ROOM_DATA_PER_SLAB 4
+
+// One slab of session data fits a full room
+static mem_pool_t sess_data_pool = MEM_POOL_INITIALIZER(fool_session_data_t, MAX_PLAYERS_PER_GAME);
+static mem_pool_t room_data_pool = MEM_POOL_INITIALIZER(fool_room_data_t, ROOM_DATA_PER_SLAB);
+
 // View
 #define CHARS_TO_TRUMP 70
 
+// Whoever holds the game up for this long passes automatically
+#define TURN_TIMEOUT_SEC 60
+
 static const char tutorial_text[] = 
     "Welcome to the game of FOOL! "
     "If there is more than 1 player, or the game is ongoing, you can press ENTER to start/continue the game\r\n"
@@ -40,6 +50,9 @@ static const char tutorial_text[] =
     "   <quit>: quit the game, works at any moment\r\n"
     "   <chat>: switch to in-game chat, works only when the game is in progress\r\n"
     "   <game>: switch back from chat to game\r\n"
+    "   <history>: show the whole chat history, works only in chat\r\n"
+    "   </join *channel*>, </leave *channel*>, </channels>, <#*channel* *msg*>: chat channels, in chat\r\n"
+    "   </w *user* *msg*>: whisper to a user, works only in chat\r\n"
     "   <tutor>: show this message again\r\n"
     "   any letter: play the card indexed by the letter (if you can play that card)\r\n"
     "   empty line: pass (if rules allow it right now)\r\n";
@@ -48,11 +61,12 @@ static void reset_room(server_room_t *s_room);
 
 void fool_init_room(server_room_t *s_room, void *payload)
 {
-    s_room->sess_cap = MAX_PLAYERS_PER_GAME;
-    s_room->sess_refs = malloc(s_room->sess_cap * sizeof(*s_room->sess_refs));
-    s_room->data = malloc(sizeof(fool_room_data_t));
+    s_room->data = pool_alloc(&room_data_pool);
+    mem_charge(&s_room->mem, room_data_pool.elem_size);
 
     fool_room_data_t *r_data = s_room->data;
+    room_members_init(s_room, MAX_PLAYERS_PER_GAME, true);
+
     game_payload_t *payload_data = payload;
     r_data->hub_ref = payload_data->hub_ref;
 
@@ -61,37 +75,43 @@ void fool_init_room(server_room_t *s_room, void *payload)
 
 void fool_deinit_room(server_room_t *s_room)
 {
-    free(s_room->data);
-    free(s_room->sess_refs);
+    mem_uncharge(&s_room->mem, room_data_pool.elem_size);
+    pool_free(&room_data_pool, s_room->data);
+    room_members_deinit(s_room);
 }
 
 static void start_game(server_room_t *s_room);
 
 void fool_init_room_session(room_session_t *r_sess)
 {
-    r_sess->data = malloc(sizeof(fool_session_data_t));
+    r_sess->data = pool_alloc(&sess_data_pool);
+    mem_charge(&r_sess->room->mem, sess_data_pool.elem_size);
 
     fool_session_data_t *rs_data = r_sess->data;
     server_room_t *s_room = r_sess->room;
     fool_room_data_t *r_data = s_room->data;
 
     rs_data->state = ps_waiting;
-    rs_data->hand = ll_create();
+    svec_init(&rs_data->hand);
+
+    // Turned away sessions never take part, leaving must not end the game
+    if (s_room->sess_cnt >= s_room->sess_cap || r_data->state != gs_awaiting_players)
+        rs_data->state = ps_spectating;
 
     if (s_room->sess_cnt >= s_room->sess_cap) {
         OUTBUF_POSTF(r_sess, "The server is full (%d/%d)!\r\n",
                      s_room->sess_cap, s_room->sess_cap);
         
-        r_sess->interf->next_room = r_data->hub_ref;
+        set_next_room(r_sess->interf, r_data->hub_ref);
         return;
     } else if (r_data->state != gs_awaiting_players) {
         OUTBUF_POST(r_sess, "The game has already started! Try again later\r\n");
-        r_sess->interf->next_room = r_data->hub_ref;
+        set_next_room(r_sess->interf, r_data->hub_ref);
         return;
     }
 
     OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
-    s_room->sess_refs[s_room->sess_cnt++] = r_sess;
+    room_add_member(s_room, r_sess);
 
     if (s_room->sess_cnt == s_room->sess_cap)
         start_game(s_room);        
@@ -105,23 +125,14 @@ void fool_deinit_room_session(room_session_t *r_sess)
     server_room_t *s_room = r_sess->room;
     fool_room_data_t *r_data = s_room->data;
 
-    // If not reset, remove from player array and shift others
-    bool offset = false;
-    for (int i = 0; i < s_room->sess_cnt; i++) {
-        if (s_room->sess_refs[i] == r_sess) {
-            offset = true;
-
-            if (r_data->defender_index > i)
-                r_data->defender_index--;
-            if (r_data->attacker_index > i)
-                r_data->attacker_index--;
-        } else if (offset) {
-            s_room->sess_refs[i-1] = s_room->sess_refs[i];
-            s_room->sess_refs[i] = NULL;
-        }
+    // If not reset, remove from player array, the others shift down
+    int idx = room_remove_member(s_room, r_sess);
+    if (idx >= 0) {
+        if (r_data->defender_index > idx)
+            r_data->defender_index--;
+        if (r_data->attacker_index > idx)
+            r_data->attacker_index--;
     }
-    if (offset) 
-        s_room->sess_cnt--;
 
     // If a live player has disconnected, end the game
     if (
@@ -137,8 +148,9 @@ void fool_deinit_room_session(room_session_t *r_sess)
     if (s_room->sess_cnt == 0)
         reset_room(s_room);
 
-    ll_free(rs_data->hand);
-    free(rs_data);
+    svec_deinit(&rs_data->hand);
+    mem_uncharge(&s_room->mem, sess_data_pool.elem_size);
+    pool_free(&sess_data_pool, rs_data);
     r_sess->data = NULL;
 }
 
@@ -150,14 +162,82 @@ static void process_defender_first_card(room_session_t *r_sess, server_room_t *s
 static void process_attacker_in_free_for_all(room_session_t *r_sess, server_room_t *s_room, const char *line);
 static void process_defender_in_free_for_all(room_session_t *r_sess, server_room_t *s_room, const char *line);
 
+// Commands other than <quit> are only taken mid-game, outside the tutorial
+static inline bool takes_commands(room_session_t *r_sess)
+{
+    fool_room_data_t *r_data = r_sess->room->data;
+    return r_data->state != gs_game_end && r_data->state != gs_awaiting_players &&
+           !r_sess->is_in_tutorial;
+}
+
+static bool cmd_quit(room_session_t *r_sess, const char *args)
+{
+    fool_room_data_t *r_data = r_sess->room->data;
+    set_next_room(r_sess->interf, r_data->hub_ref);
+    return true;
+}
+
+static bool cmd_tutor(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess))
+        return false;
+    r_sess->is_in_tutorial = true;
+    OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
+    return true;
+}
+
+static bool cmd_game(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || !r_sess->is_in_chat)
+        return false;
+    r_sess->is_in_chat = false;
+    send_updates_to_player(r_sess->room, get_player_index(r_sess, r_sess->room));
+    return true;
+}
+
+static bool cmd_history(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || !r_sess->is_in_chat)
+        return false;
+    chat_send_history(r_sess, "In-game chat\r\n\r\n");
+    return true;
+}
+
+static bool cmd_chat(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || r_sess->is_in_chat)
+        return false;
+    r_sess->is_in_chat = true;
+    chat_send_updates(r_sess, "In-game chat\r\n\r\n");
+    return true;
+}
+
+static const command_t command_list[] = {
+    { "quit",       ca_none,    &cmd_quit },
+    { "tutor",      ca_none,    &cmd_tutor },
+    { "game",       ca_none,    &cmd_game },
+    { "history",    ca_none,    &cmd_history },
+    { "chat",       ca_none,    &cmd_chat }
+};
+
+static command_table_t commands;
+
+void fool_init_subsystems()
+{
+    cmdt_init(&commands, command_list, sizeof(command_list)/sizeof(*command_list));
+}
+
 void fool_process_line(room_session_t *r_sess, const char *line)
 {
     fool_session_data_t *rs_data = r_sess->data;
     server_room_t *s_room = r_sess->room;
     fool_room_data_t *r_data = s_room->data;
 
-    if (streq(line, "quit") || r_data->state == gs_game_end) {
-        r_sess->interf->next_room = r_data->hub_ref;
+    if (cmdt_dispatch(&commands, r_sess, line))
+        return;
+
+    if (r_data->state == gs_game_end) {
+        set_next_room(r_sess->interf, r_data->hub_ref);
         return;
     }
 
@@ -171,30 +251,20 @@ void fool_process_line(room_session_t *r_sess, const char *line)
     if (r_sess->is_in_tutorial) {
         r_sess->is_in_tutorial = false;
         if (r_sess->is_in_chat)
-            chat_send_updates(s_room->chat, r_sess, "In-game chat\r\n\r\n");
+            chat_send_updates(r_sess, "In-game chat\r\n\r\n");
         else
             send_updates_to_player(s_room, get_player_index(r_sess, s_room));
         
         return;
-    } else if (streq(line, "tutor")) {
-        r_sess->is_in_tutorial = true;
-        OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
-        return;
     }
 
     if (r_sess->is_in_chat) {
-        if (streq(line, "game")) {
-            r_sess->is_in_chat = false;
-            send_updates_to_player(s_room, get_player_index(r_sess, s_room));
-        } else if (strlen(line) > 0) {
-            if (!chat_try_post_message(s_room->chat, s_room, r_sess, line))
-                OUTBUF_POST(r_sess, "The message is too long!\r\n");
+        if (strlen(line) > 0 && !chat_try_process_command(r_sess, line)) {
+            chat_post_result_t res = chat_try_post_message(s_room->chat, s_room, r_sess, line);
+            if (res != cpr_ok)
+                OUTBUF_POST(r_sess, chat_post_result_text(res));
         }
         return;
-    } else if (streq(line, "chat")) {
-        r_sess->is_in_chat = true;
-        chat_send_updates(s_room->chat, r_sess, "In-game chat\r\n\r\n");
-        return;
     }
 
     if (r_data->state == gs_first_card && rs_data->state == ps_defending)
@@ -217,6 +287,8 @@ static void end_game_with_message(server_room_t *s_room, const char *msg)
 {
     fool_room_data_t *r_data = s_room->data;
     r_data->state = gs_game_end;
+    room_cancel_timer(s_room);
+    room_state_changed(s_room);
 
     for (int i = 0; i < s_room->sess_cnt; i++) {
         room_session_t *r_sess = s_room->sess_refs[i]; 
@@ -227,12 +299,10 @@ static void end_game_with_message(server_room_t *s_room, const char *msg)
 
 static void reset_room(server_room_t *s_room)
 {
-    for (int i = 0; i < s_room->sess_cap; i++)
-        s_room->sess_refs[i] = NULL;
-
-    s_room->sess_cnt = 0;
+    ASSERT(s_room->sess_cnt == 0);
 
     fool_room_data_t *r_data = s_room->data;
+    room_cancel_timer(s_room);
 
     r_data->num_active_players = 0;
 
@@ -261,6 +331,7 @@ static void start_game(server_room_t *s_room)
 
     r_data->state = gs_first_card;
     r_data->num_active_players = s_room->sess_cnt;
+    room_state_changed(s_room);
 
     replenish_hands(s_room);
     choose_first_turn(s_room);
@@ -284,12 +355,12 @@ static void replenish_hands(server_room_t *s_room)
             continue;
         }
 
-        while (rs_data->hand->size < BASE_PLAYER_CARDS) {
+        while (rs_data->hand.size < BASE_PLAYER_CARDS) {
             card_t *card = pop_card_from_deck(&r_data->deck);
             if (!card)
                 goto loop_brk;
 
-            ll_push_front(rs_data->hand, card);
+            svec_push(&rs_data->hand, card);
         }
 
         inc_cycl(&player_idx, s_room->sess_cnt);
@@ -309,9 +380,8 @@ static void choose_first_turn(server_room_t *s_room)
     for (int i = 0; i < s_room->sess_cnt; i++)
     {
         fool_session_data_t *rs_data = data_at_index(s_room, i);
-        list_node_t *card_node = rs_data->hand->head;
-        while (card_node) {
-            card_t *card = card_node->data;
+        for (int j = 0; j < rs_data->hand.size; j++) {
+            card_t *card = rs_data->hand.data[j];
             if (
                     card->suit == r_data->deck.trump.suit &&
                     card->val < min_card_val
@@ -320,8 +390,6 @@ static void choose_first_turn(server_room_t *s_room)
                 r_data->attacker_index = i;
                 min_card_val = card->val;
             }
-
-            card_node = card_node->next;
         }
     }
 
@@ -335,7 +403,7 @@ static void choose_first_turn(server_room_t *s_room)
 static void respond_to_invalid_command(room_session_t *r_sess);
 static void switch_turn(server_room_t *s_room, bool defender_lost);
 static void enable_free_for_all(server_room_t *s_room);
-static list_node_t *try_retrieve_card_from_hand(fool_session_data_t *rs_data, const char *line);
+static int try_retrieve_card_from_hand(fool_session_data_t *rs_data, const char *line);
 
 static void process_attacker_first_card(room_session_t *r_sess, server_room_t *s_room, const char *line)
 {
@@ -349,11 +417,11 @@ static void process_attacker_first_card(room_session_t *r_sess, server_room_t *s
     if (strlen(line) == 0) // Chosen attacker can not forfeit first round
         respond_to_invalid_command(r_sess);
     else {
-        list_node_t *card_node = try_retrieve_card_from_hand(rs_data, line);
-        if (!card_node)
+        int card_idx = try_retrieve_card_from_hand(rs_data, line);
+        if (card_idx < 0)
             respond_to_invalid_command(r_sess);
-        else if (attacker_try_play_card(table, card_node->data)) {
-            ll_remove(rs_data->hand, card_node);
+        else if (attacker_try_play_card(table, svec_at(&rs_data->hand, card_idx))) {
+            svec_remove(&rs_data->hand, card_idx);
             // Once the first attacker card is placed, it is free for all
             enable_free_for_all(s_room);
 
@@ -382,7 +450,7 @@ static void process_attacker_in_free_for_all(room_session_t *r_sess, server_room
     ASSERT(r_data->state == gs_free_for_all && rs_data->state == ps_attacking);
 
     table_t *table = &r_data->table;
-    linked_list_t *def_hand = data_at_index(s_room, r_data->defender_index)->hand;
+    small_vec_t *def_hand = &data_at_index(s_room, r_data->defender_index)->hand;
 
     if (strlen(line) == 0) {
         rs_data->state = ps_waiting;
@@ -397,13 +465,13 @@ static void process_attacker_in_free_for_all(room_session_t *r_sess, server_room
     } else if (table_is_full(table, def_hand))
         respond_to_invalid_command(r_sess);
     else {
-        list_node_t *card_node = try_retrieve_card_from_hand(rs_data, line);
-        if (!card_node)
+        int card_idx = try_retrieve_card_from_hand(rs_data, line);
+        if (card_idx < 0)
             respond_to_invalid_command(r_sess);
-        else if (attacker_try_play_card(table, card_node->data)) {
-            ll_remove(rs_data->hand, card_node);
+        else if (attacker_try_play_card(table, svec_at(&rs_data->hand, card_idx))) {
+            svec_remove(&rs_data->hand, card_idx);
 
-            if (!player_can_attack(table, rs_data->hand)) {
+            if (!player_can_attack(table, &rs_data->hand)) {
                 rs_data->can_attack = false;
                 r_data->attackers_left--;
             }
@@ -424,7 +492,7 @@ static void process_defender_in_free_for_all(room_session_t *r_sess, server_room
 
     table_t *table = &r_data->table;
     card_suit_t trump_suit = r_data->deck.trump.suit;
-    linked_list_t *def_hand = data_at_index(s_room, r_data->defender_index)->hand;
+    small_vec_t *def_hand = &data_at_index(s_room, r_data->defender_index)->hand;
 
     if (strlen(line) == 0) {
         // We assume table is not beaten, cause if it is and turn is not over, then attackers > 0 && table is not full
@@ -438,11 +506,11 @@ static void process_defender_in_free_for_all(room_session_t *r_sess, server_room
     } else if (table_is_beaten(table))
         respond_to_invalid_command(r_sess); // Cant defend at a beaten table
     else {
-        list_node_t *card_node = try_retrieve_card_from_hand(rs_data, line);
-        if (!card_node)
+        int card_idx = try_retrieve_card_from_hand(rs_data, line);
+        if (card_idx < 0)
             respond_to_invalid_command(r_sess);
-        else if (defender_try_play_card(table, card_node->data, trump_suit)) {
-            ll_remove(rs_data->hand, card_node);
+        else if (defender_try_play_card(table, svec_at(&rs_data->hand, card_idx), trump_suit)) {
+            svec_remove(&rs_data->hand, card_idx);
 
             if (table_is_full(table, def_hand) && table_is_beaten(table))
                 switch_turn(s_room, false);
@@ -459,11 +527,60 @@ static void process_defender_in_free_for_all(room_session_t *r_sess, server_room
     }
 }
 
+// Those who hold the game up pass, as if they had sent an empty line
+void fool_turn_timed_out(server_room_t *s_room)
+{
+    fool_room_data_t *r_data = s_room->data;
+
+    if (r_data->state == gs_first_card) {
+        // The first attacker can not pass, so the first card in hand goes
+        room_session_t *r_sess = s_room->sess_refs[r_data->attacker_index];
+        process_attacker_first_card(r_sess, s_room, "a");
+    } else if (r_data->state == gs_free_for_all) {
+        for (int i = 0; i < s_room->sess_cnt && r_data->state == gs_free_for_all; i++) {
+            if (data_at_index(s_room, i)->state == ps_attacking)
+                process_attacker_in_free_for_all(s_room->sess_refs[i], s_room, "");
+        }
+
+        // Unless that has ended the turn, the defender takes the cards
+        if (r_data->state == gs_free_for_all && !table_is_beaten(&r_data->table)) {
+            room_session_t *r_sess = s_room->sess_refs[r_data->defender_index];
+            process_defender_in_free_for_all(r_sess, s_room, "");
+        }
+    } else
+        return;
+
+    if (r_data->state == gs_game_end)
+        return;
+    const char *msg = "Time is up, the turn has been played automatically\r\n";
+    for (int i = 0; i < s_room->sess_cnt; i++) {
+        room_session_t *r_sess = s_room->sess_refs[i];
+        if (!r_sess->is_in_chat)
+            outbuf_append(r_sess->interf, msg, strlen(msg));
+    }
+}
+
+// Puts back the screen the player was on when the connection dropped
+void fool_resume_room_session(room_session_t *r_sess)
+{
+    server_room_t *s_room = r_sess->room;
+    fool_room_data_t *r_data = s_room->data;
+
+    if (r_data->state == gs_game_end)
+        OUTBUF_POST(r_sess, "The game has ended. Press ENTER to exit\r\n");
+    else if (r_data->state == gs_awaiting_players || r_sess->is_in_tutorial)
+        OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
+    else if (r_sess->is_in_chat)
+        chat_send_history(r_sess, "In-game chat\r\n\r\n");
+    else
+        send_updates_to_player(s_room, get_player_index(r_sess, s_room));
+}
+
 static void sb_add_attacker_prompt(string_builder_t *sb,
-                                   linked_list_t *hand,
+                                   small_vec_t *hand,
                                    server_room_t *s_room);
 static void sb_add_defender_prompt(string_builder_t *sb,
-                                   linked_list_t *hand,
+                                   small_vec_t *hand,
                                    server_room_t *s_room);
 static void sb_add_card(string_builder_t *sb, card_t card);
 
@@ -472,6 +589,11 @@ static void send_updates_to_all_players(server_room_t *s_room)
 {
     for (int i = 0; i < s_room->sess_cnt; i++)
         send_updates_to_player(s_room, i);
+
+    // This follows every move, so the turn deadline starts over here
+    fool_room_data_t *r_data = s_room->data;
+    if (r_data->state == gs_first_card || r_data->state == gs_free_for_all)
+        room_set_timer(s_room, TURN_TIMEOUT_SEC * 1000);
 }
 
 static void send_updates_to_player(server_room_t *s_room, int i)
@@ -513,7 +635,7 @@ static void send_updates_to_player(server_room_t *s_room, int i)
     {
         fool_session_data_t *p_data = s_room->sess_refs[player_idx]->data;
         const char *fmt = player_idx == r_data->defender_index ? "| %d |   " : "< %d >   ";
-        chars_used += sb_add_strf(sb, fmt, p_data->hand->size);
+        chars_used += sb_add_strf(sb, fmt, p_data->hand.size);
     }
 
     // Deck info: trump & remaining cards
@@ -539,24 +661,21 @@ static void send_updates_to_player(server_room_t *s_room, int i)
     }
 
     // Hand
-    linked_list_t *hand = rs_data->hand;
-    list_node_t *node = hand->head;
+    small_vec_t *hand = &rs_data->hand;
     for (int i = 0; i < hand->size; i++) {
-        card_t *card = node->data;
+        card_t *card = hand->data[i];
 
         sb_add_strf(sb, "%c: ", card_char_index(i));
         sb_add_card(sb, *card);
         sb_add_str(sb, "   ");
-
-        node = node->next;
     }
     sb_add_str(sb, "\r\n");
 
     // Prompts
     if (rs_data->state == ps_attacking)
-        sb_add_attacker_prompt(sb, rs_data->hand, s_room);
+        sb_add_attacker_prompt(sb, &rs_data->hand, s_room);
     else if (rs_data->state == ps_defending)
-        sb_add_defender_prompt(sb, rs_data->hand, s_room);
+        sb_add_defender_prompt(sb, &rs_data->hand, s_room);
 
     OUTBUF_POST_SB(r_sess, sb);
     sb_free(sb);
@@ -564,11 +683,8 @@ static void send_updates_to_player(server_room_t *s_room, int i)
 
 static int get_player_index(room_session_t *r_sess, server_room_t *s_room)
 {
-    for (int i = 0; i < s_room->sess_cnt; i++) {
-        if (r_sess == s_room->sess_refs[i])
-            return i;
-    }
-    return -1;
+    ASSERT(r_sess->room == s_room);
+    return r_sess->member_idx;
 }
 
 static void respond_to_invalid_command(room_session_t *r_sess)
@@ -578,52 +694,46 @@ static void respond_to_invalid_command(room_session_t *r_sess)
 
     fool_session_data_t *rs_data = r_sess->data;
     if (rs_data->state == ps_attacking)
-        sb_add_attacker_prompt(sb, rs_data->hand, r_sess->room);
+        sb_add_attacker_prompt(sb, &rs_data->hand, r_sess->room);
     else if (rs_data->state == ps_defending)
-        sb_add_defender_prompt(sb, rs_data->hand, r_sess->room);
+        sb_add_defender_prompt(sb, &rs_data->hand, r_sess->room);
 
     OUTBUF_POST_SB(r_sess, sb);
     sb_free(sb);
 }
 
 static void sb_add_attacker_prompt(string_builder_t *sb,
-                                   linked_list_t *hand,
+                                   small_vec_t *hand,
                                    server_room_t *s_room)
 {
     fool_room_data_t *r_data = s_room->data;
 
     table_t *t = &r_data->table;
-    list_node_t *node = hand->head;
-    linked_list_t *def_hand = data_at_index(s_room, r_data->defender_index)->hand;
+    small_vec_t *def_hand = &data_at_index(s_room, r_data->defender_index)->hand;
 
     if (!table_is_full(t, def_hand)) {
         for (int i = 0; i < hand->size; i++) {
-            card_t *card = node->data;
+            card_t *card = hand->data[i];
             if (attacker_can_play_card(t, *card))
                 sb_add_strf(sb, "%c", card_char_index(i));
-
-            node = node->next;
         }
     }
     sb_add_str(sb, " > ");
 }
 
 static void sb_add_defender_prompt(string_builder_t *sb,
-                                   linked_list_t *hand,
+                                   small_vec_t *hand,
                                    server_room_t *s_room)
 {
     fool_room_data_t *r_data = s_room->data;
 
     table_t *t = &r_data->table;
     card_suit_t trump_suit = r_data->deck.trump.suit;
-    list_node_t *node = hand->head;
     if (!table_is_beaten(t)) {
         for (int i = 0; i < hand->size; i++) {
-            card_t *card = node->data;
+            card_t *card = hand->data[i];
             if (defender_can_play_card(t, *card, trump_suit))
                 sb_add_strf(sb, "%c", card_char_index(i));
-
-            node = node->next;
         }
     }
     sb_add_str(sb, " => ");
@@ -673,7 +783,7 @@ static void switch_turn(server_room_t *s_room, bool defender_lost)
     fool_room_data_t *r_data = s_room->data;
 
     table_t *t = &r_data->table;
-    linked_list_t *def_hand = data_at_index(s_room, r_data->defender_index)->hand;
+    small_vec_t *def_hand = &data_at_index(s_room, r_data->defender_index)->hand;
 
     if (defender_lost)
         flush_table(t, def_hand);
@@ -685,7 +795,7 @@ static void switch_turn(server_room_t *s_room, bool defender_lost)
     // Game end check
     for (int i = 0; i < s_room->sess_cnt; i++) {
         fool_session_data_t *rs_data = data_at_index(s_room, i);
-        if (rs_data->state != ps_spectating && ll_is_empty(rs_data->hand)) {
+        if (rs_data->state != ps_spectating && svec_is_empty(&rs_data->hand)) {
             rs_data->state = ps_spectating;
             r_data->num_active_players--;
         }
@@ -720,7 +830,7 @@ static void enable_free_for_all(server_room_t *s_room)
 
         // Only count those attackers that can do smth
         if (rs_data->state == ps_attacking) {
-            if (player_can_attack(table, rs_data->hand)) {
+            if (player_can_attack(table, &rs_data->hand)) {
                 rs_data->can_attack = true;
                 r_data->attackers_left++;
             } else 
@@ -729,16 +839,16 @@ static void enable_free_for_all(server_room_t *s_room)
     }
 }
 
-static list_node_t *try_retrieve_card_from_hand(fool_session_data_t *rs_data, const char *line)
+static int try_retrieve_card_from_hand(fool_session_data_t *rs_data, const char *line)
 {
     if (strlen(line) != 1)
-        return NULL;
+        return -1;
 
     int card_int_index = card_char_index_to_int(*line); 
-    if (card_int_index < 0)
-        return NULL;
+    if (card_int_index < 0 || card_int_index >= rs_data->hand.size)
+        return -1;
 
-    return ll_find_at(rs_data->hand, card_int_index);
+    return card_int_index;
 }
 
 static void advance_turns(server_room_t *s_room, int num_turns)
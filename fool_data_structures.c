@@ -91,7 +91,7 @@ static inline bool table_is_beaten(table_t *t)
     return t->cards_played <= t->cards_beat;
 }
 
-static inline bool table_is_full(table_t *t, linked_list_t *defender_hand)
+static inline bool table_is_full(table_t *t, small_vec_t *defender_hand)
 {
     return t->cards_played >= MIN(defender_hand->size + t->cards_beat, MAX_TABLE_CARDS);
 }
@@ -120,12 +120,12 @@ static void reset_table(table_t *t)
     t->cards_beat = 0;
 }
 
-static void flush_table(table_t *t, linked_list_t *hand)
+static void flush_table(table_t *t, small_vec_t *hand)
 {
     for (int i = 0; i < t->cards_played; i++) {
-        ll_push_front(hand, t->faceoffs[i][0]);
+        svec_push(hand, t->faceoffs[i][0]);
         if (i < t->cards_beat)
-            ll_push_front(hand, t->faceoffs[i][1]);
+            svec_push(hand, t->faceoffs[i][1]);
     }
 
     reset_table(t);
@@ -194,15 +194,12 @@ static bool defender_try_play_card(table_t *t, card_t *c, card_suit_t trump_suit
     return true;
 }
 
-static bool player_can_attack(table_t *t, linked_list_t *hand)
+static bool player_can_attack(table_t *t, small_vec_t *hand)
 {
-    list_node_t *node = hand->head;
-    while (node) {
-        card_t *card = node->data;
+    for (int i = 0; i < hand->size; i++) {
+        card_t *card = hand->data[i];
         if (attacker_can_play_card(t, *card))
             return true;
-
-        node = node->next;
     }
 
     return false;
@@ -4,70 +4,125 @@
 #include "room_presets.h"
 #include "chat_funcs.h"
 #include "utils.h"
+#include "usernames.h"
+#include "account_store.h"
+#include "passwd_hash.h"
+#include "worker_pool.h"
+#include "room_registry.h"
+#include "matchmaking.h"
+#include "room_list.h"
+#include "presence.h"
+#include "commands.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #define INIT_SESS_REFS_ARR_SIZE 16
-#define INIT_ROOMS_ARR_SIZE     4
-#define MAX_ROOMS_ARR_SIZE      16*INIT_ROOMS_ARR_SIZE
 
-#define CREDENTIAL_MAX_LEN      64
+#define CREDENTIAL_MAX_LEN      ACC_USERNAME_MAX_LEN
+
+#define SESS_DATA_PER_SLAB      INIT_SESS_REFS_ARR_SIZE
 
 typedef enum hub_user_state_tag {
     hs_input_username,
     hs_input_passwd,
+    hs_checking_passwd,
     hs_create_user,
+    hs_registering,
     hs_global_chat
 } hub_user_state_t;
 
 typedef struct hub_room_data_tag {
-    server_room_t **rooms;
-    int rooms_size;
-
-    FILE *passwd_f;
-    sized_array_t *logged_in_usernames_ref;
+    room_registry_t rooms;
+    mm_queue_t queues[NUM_GAMES];   // Quickplay, by game preset
+    chat_t *game_channels[NUM_GAMES]; // Named after the presets
+    room_list_t room_list;          // Cached <listr> lines
+
+    account_store_t *accounts;
+    presence_t *presence_ref;
+
+    // The admin name is reserved, but its rights are only granted if the
+    //  account was already in the store at startup
+    const char *admin_name;
+    const char *admin_handle;   // Interned, NULL if there is no admin
 } hub_room_data_t;
 
+// Password check or hashing on the worker pool (followed by the account
+//  write for registrations). Outlives the session if it disconnects before
+//  completion, in which case r_sess is reset
+typedef struct password_job_tag {
+    room_session_t *r_sess;
+    account_store_t *accounts;
+    const char *username;
+    char passwd[CREDENTIAL_MAX_LEN+1];
+
+    // Checks: the stored value, and its replacement if it was plaintext
+    char *stored;
+    bool rehashed;
+
+    char hash[PH_HASH_MAX_LEN];
+} password_job_t;
+
 typedef struct hub_session_data_tag {
     hub_user_state_t state;
     char *expected_password;
+    password_job_t *pending_job;
 } hub_session_data_t;
 
+static mem_pool_t sess_data_pool = MEM_POOL_INITIALIZER(hub_session_data_t, SESS_DATA_PER_SLAB);
+
 static const char global_chat_greeting[] = 
     "Welcome to the global chat!\r\n"
     "Commands:\r\n"
-    "   <refresh>: show this message again and reload chat\r\n"
+    "   <refresh>: show this message again and new chat messages\r\n"
+    "   <history>: show this message again and the whole chat history\r\n"
     "   <listg>: list all supported games\r\n"
-    "   <listr>: list all current rooms\r\n"
+    "   <listr [game] [open] [page N]>: list current rooms\r\n"
+    "   <play *game name*>: join the fullest open room of a game, or a new one\r\n"
+    "   <who [page N]>: list players online and where they are\r\n"
     "   <create *game name*>: create a new room\r\n"
     "   <join *room name*>: join a room\r\n"
+    "   </join *channel*>, </leave *channel*>, </channels>: chat channels, kept in games\r\n"
+    "      (#global and one per game, named after it, are always open)\r\n"
+    "   <#*channel* *message*>: send message to a channel\r\n"
+    "   </w *user* *message*>: whisper to a user who is in a chat\r\n"
     "   <quit>: disconnect from server\r\n"
     "   anything else: send message to char\r\n\r\n";
 
-static bool passwd_file_is_correct(hub_room_data_t *r_data);
-
 void hub_init_room(server_room_t *s_room, void *payload)
 {
-    s_room->sess_cap = INIT_SESS_REFS_ARR_SIZE;
-    s_room->sess_cnt = 0;
-    s_room->sess_refs = malloc(s_room->sess_cap * sizeof(*s_room->sess_refs));
+    room_members_init(s_room, INIT_SESS_REFS_ARR_SIZE, false);
 
-    s_room->data = malloc(sizeof(hub_room_data_t));
+    s_room->data = MEM_ALLOC(mt_hub, &s_room->mem, sizeof(hub_room_data_t));
     hub_room_data_t *r_data = s_room->data;
 
-    r_data->rooms_size = INIT_ROOMS_ARR_SIZE;
-    r_data->rooms = calloc(r_data->rooms_size, sizeof(*r_data->rooms));
-
-    for (int i = 0; i < r_data->rooms_size; i++)
-        r_data->rooms[i] = NULL;
-
     hub_payload_t *payload_data = payload;
-    r_data->logged_in_usernames_ref = payload_data->logged_in_usernames;
-
-    r_data->passwd_f = fopen(payload_data->passwd_path, "r+");
-    ASSERT_ERR(r_data->passwd_f);
-    ASSERTF(passwd_file_is_correct(r_data), "Invalid password file\n");
+    rreg_init(&r_data->rooms, payload_data->max_rooms, &s_room->mem);
+    for (int i = 0; i < NUM_GAMES; i++)
+        mm_init(&r_data->queues[i], &game_presets[i]);
+    rl_init(&r_data->room_list, NUM_GAMES, &s_room->mem);
+    r_data->presence_ref = payload_data->presence;
+
+    r_data->accounts = acc_open(payload_data->accounts_path, payload_data->passwd_path);
+    ASSERTF(r_data->accounts, "Invalid account store or password file\n");
+
+    r_data->admin_name = payload_data->admin_username;
+    r_data->admin_handle = NULL;
+    if (r_data->admin_name && acc_lookup(r_data->accounts, r_data->admin_name))
+        r_data->admin_handle = uname_intern(r_data->admin_name);
+    else if (r_data->admin_name)
+        LOG_ERR("Admin account %s does not exist, admin commands are off", r_data->admin_name);
+
+    // Not fatal, the chat just does not survive restarts then
+    if (payload_data->chat_path)
+        chat_persist(s_room->chat, payload_data->chat_path);
+    chat_publish(s_room->chat, "global");
+    for (int i = 0; i < NUM_GAMES; i++)
+        r_data->game_channels[i] = chat_open_channel(game_presets[i].name);
+    chat_set_presence(payload_data->presence);
+    if (payload_data->filter_path)
+        chat_init_filter(payload_data->filter_path);
 
     // Init global subsystems for all modules (@NOTE: might not be the best place)
     if (hub_preset.init_subs_f)
@@ -80,78 +135,186 @@ void hub_init_room(server_room_t *s_room, void *payload)
 
 void hub_deinit_room(server_room_t *s_room)
 {
-    free(s_room->sess_refs);
+    room_members_deinit(s_room);
 
     hub_room_data_t *r_data = s_room->data;
-    if (r_data->passwd_f) fclose(r_data->passwd_f);
-    free(r_data->rooms);
-    free(r_data);
+    if (r_data->accounts) acc_close(r_data->accounts);
+    uname_release(r_data->admin_handle);
+    rreg_deinit(&r_data->rooms);
+    for (int i = 0; i < NUM_GAMES; i++) {
+        mm_deinit(&r_data->queues[i]);
+        destroy_chat(r_data->game_channels[i]);
+    }
+    rl_deinit(&r_data->room_list);
+    mem_free(r_data);
 }
 
 static inline void enter_global_chat(room_session_t *r_sess, hub_session_data_t *rs_data, server_room_t *s_room)
 {
     r_sess->is_in_chat = true;
-    chat_send_updates(s_room->chat, r_sess, global_chat_greeting);
+    chat_send_updates(r_sess, global_chat_greeting);
     rs_data->state = hs_global_chat;
 }
 
 void hub_init_room_session(room_session_t *r_sess)
 {
-    r_sess->data = malloc(sizeof(hub_session_data_t));
+    r_sess->data = pool_alloc(&sess_data_pool);
 
     server_room_t *s_room = r_sess->room;
     hub_session_data_t *rs_data = r_sess->data;
+    mem_charge(&s_room->mem, sizeof(*rs_data));
+    rs_data->expected_password = NULL;
+    rs_data->pending_job = NULL;
 
     // Check if this is first switch to hub. if not, straight to glob chat. Otherwise, login
-    if (r_sess->username)
+    if (r_sess->username) {
+        // Lines seen through #global while away are not sent again
+        if (r_sess->interf->hub_chat_seen > r_sess->room_sub->seen)
+            r_sess->room_sub->seen = r_sess->interf->hub_chat_seen;
         enter_global_chat(r_sess, rs_data, s_room);
+    }
     else {
         rs_data->state = hs_input_username;
-        rs_data->expected_password = NULL;
         OUTBUF_POSTF(r_sess, "%sWelcome to the TextGameServer! Input your username: ", clrscr);
     }
 
-    if (s_room->sess_cnt >= s_room->sess_cap) {
-        int new_cap = s_room->sess_cap;
-        while (s_room->sess_cnt >= new_cap)
-            new_cap += INIT_SESS_REFS_ARR_SIZE;
-        s_room->sess_refs = realloc(s_room->sess_refs, new_cap);
-        for (int i = s_room->sess_cap; i < new_cap; i++)
-            s_room->sess_refs[i] = NULL;
-        s_room->sess_cap = new_cap;
-    }
-
-    s_room->sess_refs[s_room->sess_cnt++] = r_sess;
+    room_add_member(s_room, r_sess);
 }
 
 void hub_deinit_room_session(room_session_t *r_sess)
 {
     server_room_t *s_room = r_sess->room;
-
-    bool offset = false;
-    for (int i = 0; i < s_room->sess_cnt; i++) {
-        if (s_room->sess_refs[i] == r_sess)
-            offset = true;
-        else if (offset) {
-            s_room->sess_refs[i-1] = s_room->sess_refs[i];
-            s_room->sess_refs[i] = NULL;
-        }
-    }
-    s_room->sess_cnt--;
+    room_remove_member(s_room, r_sess);
+    r_sess->interf->hub_chat_seen = r_sess->room_sub->seen;
 
     hub_session_data_t *rs_data = r_sess->data;
-    if (rs_data->expected_password) free(rs_data->expected_password);
-    free(rs_data);
+    if (rs_data->expected_password) mem_free(rs_data->expected_password);
+    if (rs_data->pending_job) rs_data->pending_job->r_sess = NULL;
+    mem_uncharge(&s_room->mem, sizeof(*rs_data));
+    pool_free(&sess_data_pool, rs_data);
 }
 
 static bool user_already_logged_in(hub_room_data_t *r_data, const char *usernm);
 static char *lookup_username_and_get_password(hub_room_data_t *r_data, const char *usernm);
-static bool add_user(hub_room_data_t *r_data, const char *usernm, const char *passwd);
+static bool cred_is_of_valid_format(const char *cred);
+static bool check_password(room_session_t *r_sess, const char *passwd);
+static bool add_user(room_session_t *r_sess, const char *passwd);
 
 static void send_games_list(room_session_t *r_sess);
-static void send_rooms_list(room_session_t *r_sess, server_room_t *s_room);
+static const room_preset_t *find_game_preset(const char *game_name);
+static void send_rooms_list(room_session_t *r_sess, server_room_t *s_room, const char *args);
+static void send_who_list(room_session_t *r_sess, server_room_t *s_room, const char *args);
 static void create_and_join_room(room_session_t *r_sess, server_room_t *s_room, const char *game_name);
+static void play_game(room_session_t *r_sess, server_room_t *s_room, const char *game_name);
 static void try_join_existing_room(room_session_t *r_sess, hub_room_data_t *r_data, const char *room_name);
+static void send_mem_stats(room_session_t *r_sess, server_room_t *s_room);
+
+static inline bool user_is_admin(room_session_t *r_sess)
+{
+    hub_room_data_t *r_data = r_sess->room->data;
+    return r_data->admin_handle && uname_eq(r_sess->username, r_data->admin_handle);
+}
+
+static inline bool username_is_reserved(hub_room_data_t *r_data, const char *usernm)
+{
+    return r_data->admin_name && streq(usernm, r_data->admin_name);
+}
+
+static bool cmd_refresh(room_session_t *r_sess, const char *args)
+{
+    enter_global_chat(r_sess, r_sess->data, r_sess->room);
+    return true;
+}
+
+static bool cmd_history(room_session_t *r_sess, const char *args)
+{
+    chat_send_history(r_sess, global_chat_greeting);
+    return true;
+}
+
+static bool cmd_quit(room_session_t *r_sess, const char *args)
+{
+    r_sess->interf->quit = true;
+    return true;
+}
+
+static bool cmd_listg(room_session_t *r_sess, const char *args)
+{
+    send_games_list(r_sess);
+    return true;
+}
+
+static bool cmd_listr(room_session_t *r_sess, const char *args)
+{
+    send_rooms_list(r_sess, r_sess->room, args);
+    return true;
+}
+
+static bool cmd_who(room_session_t *r_sess, const char *args)
+{
+    send_who_list(r_sess, r_sess->room, args);
+    return true;
+}
+
+static bool cmd_play(room_session_t *r_sess, const char *args)
+{
+    play_game(r_sess, r_sess->room, args);
+    return true;
+}
+
+static bool cmd_create(room_session_t *r_sess, const char *args)
+{
+    create_and_join_room(r_sess, r_sess->room, args);
+    return true;
+}
+
+static bool cmd_join(room_session_t *r_sess, const char *args)
+{
+    try_join_existing_room(r_sess, r_sess->room->data, args);
+    return true;
+}
+
+// For everyone else, admin commands are just chat lines
+static bool cmd_memstats(room_session_t *r_sess, const char *args)
+{
+    if (!user_is_admin(r_sess))
+        return false;
+    send_mem_stats(r_sess, r_sess->room);
+    return true;
+}
+
+static bool cmd_filterreload(room_session_t *r_sess, const char *args)
+{
+    if (!user_is_admin(r_sess))
+        return false;
+    if (chat_reload_filter(r_sess))
+        OUTBUF_POST(r_sess, "Reloading the chat filter...\r\n");
+    else
+        OUTBUF_POST(r_sess, "The server is busy, try again later\r\n");
+    return true;
+}
+
+// Global chat commands
+static const command_t command_list[] = {
+    { "refresh",        ca_none,        &cmd_refresh },
+    { "history",        ca_none,        &cmd_history },
+    { "quit",           ca_none,        &cmd_quit },
+    { "listg",          ca_none,        &cmd_listg },
+    { "listr",          ca_optional,    &cmd_listr },
+    { "who",            ca_optional,    &cmd_who },
+    { "play",           ca_required,    &cmd_play },
+    { "create",         ca_required,    &cmd_create },
+    { "join",           ca_required,    &cmd_join },
+    { "memstats",       ca_none,        &cmd_memstats },
+    { "filterreload",   ca_none,        &cmd_filterreload }
+};
+
+static command_table_t commands;
+
+void hub_init_subsystems()
+{
+    cmdt_init(&commands, command_list, sizeof(command_list)/sizeof(*command_list));
+}
 
 void hub_process_line(room_session_t *r_sess, const char *line)
 {
@@ -168,11 +331,21 @@ void hub_process_line(room_session_t *r_sess, const char *line)
                     break;
                 }
 
+                if (strncmp(line, "resume ", 7) == 0) {
+                    char *req = r_sess->interf->resume_req;
+                    strncpy(req, line+7, RESUME_TOKEN_LEN);
+                    req[RESUME_TOKEN_LEN] = '\0';
+                    if (!req[0])
+                        strcpy(req, "-");
+                    break;
+                }
+
                 if (user_already_logged_in(r_data, line)) {
                     OUTBUF_POST(r_sess, "Such a user is already logged in, try another account\r\nInput your username: ");
                     break;
                 }
-                r_sess->username = strdup(line);
+                uname_release(r_sess->username);
+                r_sess->username = uname_intern(line);
                 rs_data->expected_password = lookup_username_and_get_password(r_data, line);
                 if (rs_data->expected_password) {
                     OUTBUF_POST(r_sess, "Input your password: ");
@@ -195,14 +368,16 @@ void hub_process_line(room_session_t *r_sess, const char *line)
                     OUTBUF_POST(r_sess, "While you were thiking, someone has logged into this account!\r\nInput your username: ");
                     break;
                 }
-                if (streq(rs_data->expected_password, line)) {
-                    enter_global_chat(r_sess, rs_data, s_room);
-                    r_sess->interf->need_to_register_username = true;
-                } else {
+                if (strlen(line) > CREDENTIAL_MAX_LEN) {
                     rs_data->state = hs_input_username;
                     OUTBUF_POST(r_sess, "The password is incorrect! Rack your memory and try again\r\nInput your username: ");
+                } else if (check_password(r_sess, line))
+                    rs_data->state = hs_checking_passwd;
+                else {
+                    rs_data->state = hs_input_username;
+                    OUTBUF_POST(r_sess, "The server is busy, try again later\r\nInput your username: ");
                 }
-                free(rs_data->expected_password);
+                mem_free(rs_data->expected_password);
                 rs_data->expected_password = NULL;
             } break;
 
@@ -218,34 +393,38 @@ void hub_process_line(room_session_t *r_sess, const char *line)
                     OUTBUF_POST(r_sess, "While you were thiking, someone has logged into this account!\r\nInput your username: ");
                     break;
                 }
-                if (add_user(r_data, r_sess->username, line)) {
-                    enter_global_chat(r_sess, rs_data, s_room);
-                    r_sess->interf->need_to_register_username = true;
-                } else {
+                if (
+                        !cred_is_of_valid_format(r_sess->username) || !cred_is_of_valid_format(line) ||
+                        username_is_reserved(r_data, r_sess->username)
+                   )
+                {
                     rs_data->state = hs_input_username;
                     OUTBUF_POST(r_sess, "The username or password is invalid, try registering again\r\nInput your username: ");
+                } else if (add_user(r_sess, line)) {
+                    rs_data->state = hs_registering;
+                    OUTBUF_POST(r_sess, "Creating your account...\r\n");
+                } else {
+                    rs_data->state = hs_input_username;
+                    OUTBUF_POST(r_sess, "The server is busy, try again later\r\nInput your username: ");
                 }
             } break;
 
+        case hs_checking_passwd:
+        case hs_registering:
+            OUTBUF_POST(r_sess, "Please wait...\r\n");
+            break;
+
         case hs_global_chat:
             {
                 ASSERT(r_sess->is_in_chat);
 
-                if (streq(line, "refresh"))
-                    enter_global_chat(r_sess, rs_data, s_room);
-                else if (streq(line, "quit"))
-                    r_sess->interf->quit = true;
-                else if (streq(line, "listg"))
-                    send_games_list(r_sess); 
-                else if (streq(line, "listr"))
-                    send_rooms_list(r_sess, s_room); 
-                else if (strncmp(line, "create ", 7) == 0)
-                    create_and_join_room(r_sess, s_room, line+7);
-                else if (strncmp(line, "join ", 5) == 0)
-                    try_join_existing_room(r_sess, r_data, line+5);
-                else if (strlen(line) > 0) {
-                    if (!chat_try_post_message(s_room->chat, s_room, r_sess, line))
-                        OUTBUF_POST(r_sess, "The message is too long!\r\n");
+                if (cmdt_dispatch(&commands, r_sess, line))
+                    break;
+
+                if (strlen(line) > 0 && !chat_try_process_command(r_sess, line)) {
+                    chat_post_result_t res = chat_try_post_message(s_room->chat, s_room, r_sess, line);
+                    if (res != cpr_ok)
+                        OUTBUF_POST(r_sess, chat_post_result_text(res));
                 }
             } break;
     }
@@ -259,47 +438,13 @@ bool hub_is_available(server_room_t *s_room)
 
 static bool user_already_logged_in(hub_room_data_t *r_data, const char *usernm)
 {
-    for (int i = 0; i < r_data->logged_in_usernames_ref->size; i++) {
-        char *existing_name = r_data->logged_in_usernames_ref->data[i];
-        if (existing_name && streq(usernm, existing_name))
-            return true;
-    }
-
-    return false;
+    return pres_find(r_data->presence_ref, usernm) != NULL;
 }
 
 static char *lookup_username_and_get_password(hub_room_data_t *r_data, const char *usernm)
 {
-    FILE *f = r_data->passwd_f;
-    rewind(f);
-
-    char cred_buf[CREDENTIAL_MAX_LEN+1];
-    size_t buflen;
-    int break_c = '\0';
-
-    bool reading_usernm = true;
-    while (break_c != EOF) {
-        buflen = fread_word_to_buf(f, cred_buf, sizeof(cred_buf), &break_c);
-        if (buflen == 0)
-            continue;
-
-        if (reading_usernm && streq(cred_buf, usernm))
-            break;
-
-        reading_usernm = !reading_usernm;
-    }
-
-    if (break_c == EOF)
-        return NULL;
-
-    do {
-        buflen = fread_word_to_buf(f, cred_buf, sizeof(cred_buf), &break_c);
-    } while (break_c != EOF && buflen == 0);
-
-    if (buflen == 0)
-        return NULL;
-
-    return strdup(cred_buf);
+    const char *passwd = acc_lookup(r_data->accounts, usernm);
+    return passwd ? MEM_STRDUP(mt_hub, NULL, passwd) : NULL;
 }
 
 static bool cred_is_of_valid_format(const char *cred)
@@ -316,22 +461,158 @@ static bool cred_is_of_valid_format(const char *cred)
     return true;
 }
 
-static bool add_user(hub_room_data_t *r_data, const char *usernm, const char *passwd)
+// Completions of one dispatch all run before the server gets to register
+//  anyone, so the name is taken right here and not in server_register_user
+static bool claim_username(room_session_t *r_sess)
 {
-    FILE *f = r_data->passwd_f;
-    fseek(f, 0, SEEK_END);
-    if (cred_is_of_valid_format(usernm) && cred_is_of_valid_format(passwd)) {
-        fprintf(f, "%s %s\n", usernm, passwd);
-        fflush(f);
-        return true;
-    } else
+    hub_room_data_t *r_data = r_sess->room->data;
+    presence_entry_t *entry = pres_add(r_data->presence_ref, r_sess->username, r_sess);
+    if (!entry)
         return false;
+
+    r_sess->interf->presence = entry;
+    r_sess->interf->need_to_register_username = true;
+    return true;
+}
+
+static void free_password_job(password_job_t *job)
+{
+    if (job->r_sess) {
+        hub_session_data_t *rs_data = job->r_sess->data;
+        rs_data->pending_job = NULL;
+    }
+    uname_release(job->username);
+    if (job->stored) mem_free(job->stored);
+    memset(job->passwd, 0, sizeof(job->passwd));
+    mem_free(job);
+}
+
+// Takes ownership of stored
+static bool start_password_job(room_session_t *r_sess, const char *passwd, char *stored,
+                               work_func_t work_f, completion_func_t done_f)
+{
+    password_job_t *job = MEM_CALLOC(mt_hub, NULL, 1, sizeof(*job));
+    job->r_sess = r_sess;
+    job->accounts = ((hub_room_data_t *) r_sess->room->data)->accounts;
+    job->username = uname_retain(r_sess->username);
+    strncpy(job->passwd, passwd, sizeof(job->passwd)-1);
+    job->stored = stored;
+
+    if (!wp_submit(work_f, done_f, job)) {
+        job->r_sess = NULL;
+        free_password_job(job);
+        return false;
+    }
+
+    hub_session_data_t *rs_data = r_sess->data;
+    rs_data->pending_job = job;
+    return true;
+}
+
+// Worker thread
+static bool check_password_work(void *ctx)
+{
+    password_job_t *job = ctx;
+    if (!ph_verify(job->stored, job->passwd))
+        return false;
+
+    // Legacy plaintext entries are replaced with a hash on the first login
+    if (!ph_is_hashed(job->stored))
+        job->rehashed = ph_hash(job->passwd, job->hash, sizeof(job->hash));
+    return true;
+}
+
+static void check_password_done(void *ctx, bool ok)
+{
+    password_job_t *job = ctx;
+    room_session_t *r_sess = job->r_sess;
+
+    if (ok && job->rehashed)
+        acc_set_passwd_async(job->accounts, job->username, job->hash, NULL, NULL);
+
+    if (r_sess) {
+        hub_session_data_t *rs_data = r_sess->data;
+        server_room_t *s_room = r_sess->room;
+
+        if (!ok) {
+            rs_data->state = hs_input_username;
+            OUTBUF_POST(r_sess, "The password is incorrect! Rack your memory and try again\r\nInput your username: ");
+        } else if (!claim_username(r_sess)) {
+            rs_data->state = hs_input_username;
+            OUTBUF_POST(r_sess, "While you were thiking, someone has logged into this account!\r\nInput your username: ");
+        } else
+            enter_global_chat(r_sess, rs_data, s_room);
+    }
+
+    free_password_job(job);
+}
+
+static bool check_password(room_session_t *r_sess, const char *passwd)
+{
+    hub_session_data_t *rs_data = r_sess->data;
+    char *stored = rs_data->expected_password;
+    rs_data->expected_password = NULL;
+    return start_password_job(r_sess, passwd, stored, check_password_work, check_password_done);
+}
+
+static void registration_done(void *ctx, bool ok)
+{
+    password_job_t *job = ctx;
+    room_session_t *r_sess = job->r_sess;
+
+    if (r_sess) {
+        hub_session_data_t *rs_data = r_sess->data;
+        if (ok && !claim_username(r_sess)) {
+            rs_data->state = hs_input_username;
+            OUTBUF_POST(r_sess, "While you were thiking, someone has logged into this account!\r\nInput your username: ");
+        } else if (ok)
+            enter_global_chat(r_sess, rs_data, r_sess->room);
+        else {
+            rs_data->state = hs_input_username;
+            OUTBUF_POST(r_sess, "Failed to save your account, try registering again\r\nInput your username: ");
+        }
+    }
+
+    free_password_job(job);
+}
+
+// Worker thread
+static bool hash_password_work(void *ctx)
+{
+    password_job_t *job = ctx;
+    return ph_hash(job->passwd, job->hash, sizeof(job->hash));
+}
+
+// The account is written only once the hash is ready, and the session is
+//  moved into the chat by registration_done once it is on disk
+static void hash_password_done(void *ctx, bool ok)
+{
+    password_job_t *job = ctx;
+    room_session_t *r_sess = job->r_sess;
+
+    if (!r_sess) { // Disconnected while hashing, nothing to save
+        free_password_job(job);
+        return;
+    }
+
+    if (ok && acc_add_async(job->accounts, job->username, job->hash, registration_done, job))
+        return;
+
+    hub_session_data_t *rs_data = r_sess->data;
+    rs_data->state = hs_input_username;
+    OUTBUF_POST(r_sess, "The username is taken or invalid, try registering again\r\nInput your username: ");
+    free_password_job(job);
+}
+
+static bool add_user(room_session_t *r_sess, const char *passwd)
+{
+    return start_password_job(r_sess, passwd, NULL, hash_password_work, hash_password_done);
 }
 
 static void send_games_list(room_session_t *r_sess)
 {
     string_builder_t *sb = sb_create();
-    sb_add_strf(sb, "\r\nAvailable games:\r\n", MAX_ROOMS_ARR_SIZE);
+    sb_add_str(sb, "\r\nAvailable games:\r\n");
     for (int i = 0; i < NUM_GAMES; i++)
         sb_add_strf(sb, "   %s\r\n", game_presets[i].name);
     sb_add_str(sb, "\r\n");
@@ -340,107 +621,208 @@ static void send_games_list(room_session_t *r_sess)
     sb_free(sb);
 }
 
-static void send_rooms_list(room_session_t *r_sess, server_room_t *s_room)
+// listr [game] [open] [page N], in any order
+static void send_rooms_list(room_session_t *r_sess, server_room_t *s_room, const char *args)
 {
     hub_room_data_t *r_data = s_room->data;
+
+    const room_preset_t *preset = NULL;
+    bool open_only = false;
+    int page = 1;
+
+    char buf[CREDENTIAL_MAX_LEN+1];
+    cmd_tokenizer_t tok;
+    tok_init(&tok, args);
+    while (!tok_at_end(&tok)) {
+        if (!tok_word(&tok, buf, sizeof(buf))) {
+            OUTBUF_POST(r_sess, "Usage: listr [game] [open] [page N]\r\n");
+            return;
+        }
+
+        if (streq(buf, "open"))
+            open_only = true;
+        else if (streq(buf, "page")) {
+            if (!tok_spaces(&tok) || !tok_uint(&tok, INT_MAX, &page) || page < 1) {
+                OUTBUF_POST(r_sess, "Usage: listr [game] [open] [page N]\r\n");
+                return;
+            }
+        } else if ((preset = find_game_preset(buf)) == NULL) {
+            OUTBUF_POST(r_sess, "Usage: listr [game] [open] [page N]\r\n");
+            return;
+        }
+    }
+
+    int game_idx = preset ? preset - game_presets : -1;
+
+    int total = rl_count(&r_data->room_list, game_idx, open_only);
+    int pages = total > 0 ? (total + RL_PAGE_SIZE-1) / RL_PAGE_SIZE : 1;
+    if (page > pages)
+        page = pages;
+
     string_builder_t *sb = sb_create();
-    sb_add_strf(sb, "\r\nServer rooms (max=%d):\r\n", MAX_ROOMS_ARR_SIZE);
-    for (int i = 0; i < r_data->rooms_size; i++) {
-        server_room_t *room = r_data->rooms[i];
-        if (room)
-            sb_add_strf(sb, "   %s %d/%d %s\r\n", room->name,
-                    room->sess_cnt, room->sess_cap,
-                    room_is_available(room) ? "" : "(closed)");
+    sb_add_strf(sb, "\r\nServer rooms (%d of %d, max=%d), page %d/%d:\r\n",
+                total, r_data->rooms.rooms_cnt, r_data->rooms.max_rooms, page, pages);
+    rl_sb_add_page(&r_data->room_list, sb, game_idx, open_only, page-1);
+    sb_add_str(sb, "\r\n");
+
+    OUTBUF_POST_SB(r_sess, sb);
+    sb_free(sb);
+}
+
+// who [page N]
+static void send_who_list(room_session_t *r_sess, server_room_t *s_room, const char *args)
+{
+    hub_room_data_t *r_data = s_room->data;
+
+    int page = 1;
+    char buf[8];
+    cmd_tokenizer_t tok;
+    tok_init(&tok, args);
+    if (!tok_at_end(&tok)) {
+        if (
+                !tok_word(&tok, buf, sizeof(buf)) || !streq(buf, "page") ||
+                !tok_spaces(&tok) || !tok_uint(&tok, INT_MAX, &page) ||
+                !tok_at_end(&tok) || page < 1
+           )
+        {
+            OUTBUF_POST(r_sess, "Usage: who [page N]\r\n");
+            return;
+        }
     }
+
+    int total = pres_count(r_data->presence_ref);
+    int pages = total > 0 ? (total + PRES_PAGE_SIZE-1) / PRES_PAGE_SIZE : 1;
+    if (page > pages)
+        page = pages;
+
+    string_builder_t *sb = sb_create();
+    sb_add_strf(sb, "\r\nPlayers online (%d, %d in the hub), page %d/%d:\r\n",
+                total, s_room->online_cnt, page, pages);
+    pres_sb_add_page(r_data->presence_ref, sb, page-1);
     sb_add_str(sb, "\r\n");
 
     OUTBUF_POST_SB(r_sess, sb);
     sb_free(sb);
 }
 
-static void create_and_join_room(room_session_t *r_sess, server_room_t *s_room, const char *game_name)
+static inline mm_queue_t *queue_for_room(hub_room_data_t *r_data, server_room_t *room)
+{
+    return &r_data->queues[room->preset - game_presets];
+}
+
+static void game_room_occupancy_changed(server_room_t *room, void *ctx)
+{
+    hub_room_data_t *r_data = ((server_room_t *) ctx)->data;
+    mm_update(queue_for_room(r_data, room), room);
+    rl_update(&r_data->room_list, room);
+}
+
+// Game rooms are reclaimed as soon as the last session is out
+static void game_room_vacated(server_room_t *room, void *ctx)
+{
+    hub_room_data_t *r_data = ((server_room_t *) ctx)->data;
+
+    mm_remove(queue_for_room(r_data, room), room);
+    rl_remove(&r_data->room_list, room);
+    rreg_remove(&r_data->rooms, room);
+    destroy_room(room);
+}
+
+static const room_preset_t *find_game_preset(const char *game_name)
+{
+    for (int i = 0; i < NUM_GAMES; i++) {
+        if (streq(game_name, game_presets[i].name))
+            return &game_presets[i];
+    }
+    return NULL;
+}
+
+static server_room_t *create_game_room(room_session_t *r_sess, server_room_t *s_room,
+                                       const room_preset_t *preset)
 {
     hub_room_data_t *r_data = s_room->data;
     game_payload_t payload = { .hub_ref = s_room };
 
-    const room_preset_t *preset = NULL;
-    for (int i = 0; i < NUM_GAMES; i++) {
-        if (streq(game_name, game_presets[i].name)) {
-            preset = &game_presets[i];
-            break;
-        }
+    int id = rreg_reserve_id(&r_data->rooms);
+    if (id < 0) {
+        OUTBUF_POST(r_sess, "Max number of rooms is reached, wait for someone to finish playing\r\n");
+        return NULL;
     }
 
+    char id_str[16];
+    sprintf(id_str, "%d", id);
+    server_room_t *room = make_room(preset, id_str, s_room->logs_file_handle, &payload);
+    room->changed_f = game_room_occupancy_changed;
+    room->vacated_f = game_room_vacated;
+    room->hook_ctx = s_room;
+    rreg_add(&r_data->rooms, id, room);
+    mm_update(queue_for_room(r_data, room), room);
+    rl_add(&r_data->room_list, room, preset - game_presets);
+
+    return room;
+}
+
+static void create_and_join_room(room_session_t *r_sess, server_room_t *s_room, const char *game_name)
+{
+    const room_preset_t *preset = find_game_preset(game_name);
     if (!preset) {
         OUTBUF_POST(r_sess, "This server does not host such a game! Suma\r\n");
         return;
     }
 
-    server_room_t *room = NULL;
-    for (int i = 0; i <= r_data->rooms_size; i++) {
-        char id[16];
+    server_room_t *room = create_game_room(r_sess, s_room, preset);
+    if (room)
+        set_next_room(r_sess->interf, room);
+}
 
-        if (i == r_data->rooms_size) {
-            if (i >= MAX_ROOMS_ARR_SIZE) {
-                OUTBUF_POST(r_sess, "Max number of rooms is reached, wait for someone to finish playing\r\n");
-                return;
-            }
+// Quickplay: the fullest room that still takes players, or a new one
+static void play_game(room_session_t *r_sess, server_room_t *s_room, const char *game_name)
+{
+    hub_room_data_t *r_data = s_room->data;
 
-            int newsize = r_data->rooms_size + INIT_ROOMS_ARR_SIZE;
-            r_data->rooms = 
-                realloc(r_data->rooms, newsize * sizeof(*r_data->rooms));
-            for (int j = r_data->rooms_size; j < newsize; j++)
-                r_data->rooms[j] = NULL;
-            r_data->rooms_size = newsize;
-        } 
-
-        if (!r_data->rooms[i]) {
-            sprintf(id, "%d", i);
-            room = make_room(preset, id, s_room->logs_file_handle, &payload);
-            r_data->rooms[i] = room;
-            break;
-        } else if (r_data->rooms[i]->sess_cnt <= 0) {
-            // Clean up empty rooms
-            destroy_room(r_data->rooms[i]);
-            r_data->rooms[i] = NULL;
-        }
+    const room_preset_t *preset = find_game_preset(game_name);
+    if (!preset) {
+        OUTBUF_POST(r_sess, "This server does not host such a game! Suma\r\n");
+        return;
     }
 
-    r_sess->interf->next_room = room;
+    server_room_t *room = mm_pick(&r_data->queues[preset - game_presets]);
+    if (!room)
+        room = create_game_room(r_sess, s_room, preset);
+    if (room)
+        set_next_room(r_sess->interf, room);
 }
 
 static void try_join_existing_room(room_session_t *r_sess, hub_room_data_t *r_data, const char *room_name)
 {
-    for (int i = 0; i < r_data->rooms_size; i++) {
-        server_room_t *room = r_data->rooms[i];
-        if (room && streq(room_name, room->name) && room_is_available(room)) {
-            r_sess->interf->next_room = room;
-            return;
-        }
+    server_room_t *room = rreg_find(&r_data->rooms, room_name);
+    if (room && room_is_available(room)) {
+        set_next_room(r_sess->interf, room);
+        return;
     }
 
     OUTBUF_POST(r_sess, "Couldn't access the chosen room! Sumimasen\r\n");
 }
 
-static bool passwd_file_is_correct(hub_room_data_t *r_data)
+static void send_mem_stats(room_session_t *r_sess, server_room_t *s_room)
 {
-    FILE *f = r_data->passwd_f;
-    rewind(f);
-
-    char cred_buf[CREDENTIAL_MAX_LEN+2];
-    size_t buflen;
-    int break_c = '\0';
-
-    bool reading_usernm = true;
-    while (break_c != EOF) {
-        buflen = fread_word_to_buf(f, cred_buf, sizeof(cred_buf), &break_c);
-        if (buflen == 0)
-            continue;
-        else if (buflen > CREDENTIAL_MAX_LEN)
-            return false;
+    hub_room_data_t *r_data = s_room->data;
+    string_builder_t *sb = sb_create();
 
-        reading_usernm = !reading_usernm;
+    sb_add_str(sb, "\r\n");
+    mem_sb_add_subsystems(sb);
+    mem_sb_add_pools(sb);
+
+    sb_add_str(sb, "Rooms (heap + pooled objects):\r\n");
+    mem_sb_add_counters(sb, "(hub)", &s_room->mem);
+    for (int i = rreg_next(&r_data->rooms, -1); i >= 0; i = rreg_next(&r_data->rooms, i)) {
+        server_room_t *room = rreg_at(&r_data->rooms, i);
+        mem_sb_add_counters(sb, room->name, &room->mem);
     }
 
-    return reading_usernm;
+    mem_sb_add_call_sites(sb);
+    sb_add_str(sb, "\r\n");
+
+    OUTBUF_POST_SB(r_sess, sb);
+    sb_free(sb);
 }
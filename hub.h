@@ -3,6 +3,7 @@
 #define HUB_SENTRY
 #include "logic.h"
 
+void hub_init_subsystems();
 void hub_init_room(server_room_t *s_room, void *payload);
 void hub_deinit_room(server_room_t *s_room);
 void hub_init_room_session(room_session_t *r_sess);
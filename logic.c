@@ -2,25 +2,56 @@
 #include "logic.h"
 #include "utils.h"
 #include "chat_funcs.h"
+#include "usernames.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 char clrscr[] = "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n"
                 "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n"
                 "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n"
                 "\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n";
 
+#define ROOMS_PER_SLAB          16
+#define ROOM_SESSIONS_PER_SLAB  32
+#define INIT_TIMER_HEAP_SIZE    16
+
+static mem_pool_t room_pool = MEM_POOL_INITIALIZER(server_room_t, ROOMS_PER_SLAB);
+static mem_pool_t room_sess_pool = MEM_POOL_INITIALIZER(room_session_t, ROOM_SESSIONS_PER_SLAB);
+
+// Rooms with a pending timer, a min-heap by timer_due
+static server_room_t **timer_heap = NULL;
+static int timer_cnt = 0, timer_cap = 0;
+
+static void occupancy_changed(server_room_t *s_room);
+
 server_room_t *make_room(const room_preset_t *preset, const char *id, 
                          FILE *logs_file_handle, void *payload)
 {
-    server_room_t *s_room = malloc(sizeof(*s_room));
+    server_room_t *s_room = pool_alloc(&room_pool);
     s_room->preset = preset;
-    if (id) 
-        s_room->name = strcat_alloc(preset->name, id);
-    else
-        s_room->name = strdup(preset->name);
+    s_room->id = -1;
+    s_room->resident_cnt = 0;
+    s_room->incoming_cnt = 0;
+    s_room->changed_f = NULL;
+    s_room->vacated_f = NULL;
+    s_room->hook_ctx = NULL;
+    s_room->mm_bucket = -1;
+    s_room->mm_idx = -1;
+    s_room->online_cnt = 0;
+    s_room->timer_due = 0;
+    s_room->timer_idx = -1;
+    s_room->sess_refs = NULL;
+    s_room->sess_cnt = 0;
+    s_room->sess_cap = 0;
+    s_room->members_ordered = false;
+    mem_counters_init(&s_room->mem);
+
+    size_t name_len = strlen(preset->name) + (id ? strlen(id) : 0);
+    s_room->name = MEM_ALLOC(mt_logic, &s_room->mem, name_len+1);
+    sprintf(s_room->name, "%s%s", preset->name, id ? id : "");
 
-    s_room->chat = make_chat();
+    s_room->chat = make_chat(s_room, &s_room->mem);
     s_room->logs_file_handle = logs_file_handle;
 
     (*preset->init_room_f)(s_room, payload);
@@ -31,35 +62,61 @@ server_room_t *make_room(const room_preset_t *preset, const char *id,
 void destroy_room(server_room_t *s_room)
 {
     ASSERT(s_room);
+    ASSERT(s_room->resident_cnt == 0 && s_room->incoming_cnt == 0);
+    ASSERT(s_room->online_cnt == 0);
+    room_cancel_timer(s_room);
     (*s_room->preset->deinit_room_f)(s_room);
     destroy_chat(s_room->chat);
-    if (s_room->name) free(s_room->name);
-    free(s_room);
+    if (s_room->name) mem_free(s_room->name);
+    pool_free(&room_pool, s_room);
 }
 
 room_session_t *make_room_session(server_room_t *s_room,
                                   session_interface_t *interf,
-                                  char *username)
+                                  const char *username)
 {
     ASSERT(s_room);
     ASSERT(interf);
 
-    room_session_t *r_sess = malloc(sizeof(*r_sess));
+    room_session_t *r_sess = pool_alloc(&room_sess_pool);
+    mem_charge(&s_room->mem, sizeof(*r_sess));
     r_sess->room = s_room;
     r_sess->interf = interf;
-    r_sess->username = username;
+    r_sess->username = uname_retain(username);
     r_sess->is_in_chat = false;
     r_sess->is_in_tutorial = false;
+    r_sess->member_idx = -1;
+    r_sess->room_sub = chat_subscribe(s_room->chat, r_sess);
+    chat_bind_channels(r_sess);
+    s_room->resident_cnt++;
     (*s_room->preset->init_sess_f)(r_sess);
+    occupancy_changed(s_room);
 
     return r_sess;
 }
 
+static void occupancy_changed(server_room_t *s_room)
+{
+    if (s_room->changed_f)
+        (*s_room->changed_f)(s_room, s_room->hook_ctx);
+    if (s_room->resident_cnt == 0 && s_room->incoming_cnt == 0 && s_room->vacated_f)
+        (*s_room->vacated_f)(s_room, s_room->hook_ctx);
+}
+
 void destroy_room_session(room_session_t *r_sess)
 {
     ASSERT(r_sess);
-    (*r_sess->room->preset->deinit_sess_f)(r_sess);
-    free(r_sess);
+    server_room_t *s_room = r_sess->room;
+    (*s_room->preset->deinit_sess_f)(r_sess);
+    ASSERT(!room_is_member(r_sess));
+    chat_unbind_channels(r_sess);
+    chat_unsubscribe(r_sess->room_sub);
+    mem_uncharge(&s_room->mem, sizeof(*r_sess));
+    uname_release(r_sess->username);
+    pool_free(&room_sess_pool, r_sess);
+
+    s_room->resident_cnt--;
+    occupancy_changed(s_room);
 }
 
 void room_session_process_line(room_session_t *r_sess, const char *line)
@@ -73,3 +130,197 @@ void room_session_process_too_long_line(room_session_t *r_sess)
     OUTBUF_POST(r_sess, "ERR: Line was too long\r\n");
     r_sess->interf->quit = true;
 }
+
+void outbuf_append(session_interface_t *interf, const char *str, size_t len)
+{
+    interf->out_buf = realloc(interf->out_buf, interf->out_buf_len + len + 1);
+    memcpy(interf->out_buf + interf->out_buf_len, str, len);
+    interf->out_buf_len += len;
+    interf->out_buf[interf->out_buf_len] = '\0';
+}
+
+void outbuf_appendf(session_interface_t *interf, const char *fmt, ...)
+{
+    va_list vl;
+
+    va_start(vl, fmt);
+    size_t len = vsnprintf(NULL, 0, fmt, vl);
+    va_end(vl);
+
+    interf->out_buf = realloc(interf->out_buf, interf->out_buf_len + len + 1);
+
+    va_start(vl, fmt);
+    vsprintf(interf->out_buf + interf->out_buf_len, fmt, vl);
+    va_end(vl);
+
+    interf->out_buf_len += len;
+}
+
+void room_members_init(server_room_t *s_room, int cap, bool ordered)
+{
+    ASSERT(cap > 0);
+    s_room->sess_refs = MEM_ALLOC(mt_logic, &s_room->mem, cap * sizeof(*s_room->sess_refs));
+    s_room->sess_cnt = 0;
+    s_room->sess_cap = cap;
+    s_room->members_ordered = ordered;
+}
+
+void room_members_deinit(server_room_t *s_room)
+{
+    ASSERT(s_room->sess_cnt == 0);
+    if (s_room->sess_refs) mem_free(s_room->sess_refs);
+    s_room->sess_refs = NULL;
+    s_room->sess_cap = 0;
+}
+
+void room_add_member(server_room_t *s_room, room_session_t *r_sess)
+{
+    ASSERT(r_sess->room == s_room && !room_is_member(r_sess));
+
+    if (s_room->sess_cnt >= s_room->sess_cap) {
+        ASSERT(!s_room->members_ordered);
+        s_room->sess_cap *= 2;
+        s_room->sess_refs = MEM_REALLOC(s_room->sess_refs, s_room->sess_cap * sizeof(*s_room->sess_refs));
+    }
+
+    r_sess->member_idx = s_room->sess_cnt;
+    s_room->sess_refs[s_room->sess_cnt++] = r_sess;
+}
+
+int room_remove_member(server_room_t *s_room, room_session_t *r_sess)
+{
+    int idx = r_sess->member_idx;
+    if (idx < 0)
+        return -1;
+    ASSERT(idx < s_room->sess_cnt && s_room->sess_refs[idx] == r_sess);
+
+    s_room->sess_cnt--;
+    if (s_room->members_ordered) {
+        for (int i = idx; i < s_room->sess_cnt; i++) {
+            s_room->sess_refs[i] = s_room->sess_refs[i+1];
+            s_room->sess_refs[i]->member_idx = i;
+        }
+    } else if (idx < s_room->sess_cnt) {
+        // The last member takes the place
+        s_room->sess_refs[idx] = s_room->sess_refs[s_room->sess_cnt];
+        s_room->sess_refs[idx]->member_idx = idx;
+    }
+    s_room->sess_refs[s_room->sess_cnt] = NULL;
+
+    r_sess->member_idx = -1;
+    return idx;
+}
+
+void set_next_room(session_interface_t *interf, server_room_t *room)
+{
+    if (interf->next_room == room)
+        return;
+
+    clear_next_room(interf);
+    interf->next_room = room;
+    room->incoming_cnt++;
+    occupancy_changed(room);
+}
+
+void clear_next_room(session_interface_t *interf)
+{
+    server_room_t *room = interf->next_room;
+    if (!room)
+        return;
+
+    interf->next_room = NULL;
+    room->incoming_cnt--;
+    occupancy_changed(room);
+}
+
+void room_state_changed(server_room_t *s_room)
+{
+    if (s_room->changed_f)
+        (*s_room->changed_f)(s_room, s_room->hook_ctx);
+}
+
+static inline void heap_place(server_room_t *s_room, int idx)
+{
+    timer_heap[idx] = s_room;
+    s_room->timer_idx = idx;
+}
+
+static void heap_sift_up(int idx)
+{
+    server_room_t *s_room = timer_heap[idx];
+    while (idx > 0) {
+        int parent = (idx-1) / 2;
+        if (timer_heap[parent]->timer_due <= s_room->timer_due)
+            break;
+        heap_place(timer_heap[parent], idx);
+        idx = parent;
+    }
+    heap_place(s_room, idx);
+}
+
+static void heap_sift_down(int idx)
+{
+    server_room_t *s_room = timer_heap[idx];
+    for (;;) {
+        int child = 2*idx + 1;
+        if (child >= timer_cnt)
+            break;
+        if (child+1 < timer_cnt && timer_heap[child+1]->timer_due < timer_heap[child]->timer_due)
+            child++;
+        if (s_room->timer_due <= timer_heap[child]->timer_due)
+            break;
+        heap_place(timer_heap[child], idx);
+        idx = child;
+    }
+    heap_place(s_room, idx);
+}
+
+void room_set_timer(server_room_t *s_room, long delay_msec)
+{
+    ASSERT(s_room->preset->timer_f);
+
+    s_room->timer_due = get_msec() + delay_msec;
+    if (s_room->timer_idx >= 0) {
+        heap_sift_up(s_room->timer_idx);
+        heap_sift_down(s_room->timer_idx);
+        return;
+    }
+
+    if (timer_cnt >= timer_cap) {
+        timer_cap = timer_cap ? timer_cap * 2 : INIT_TIMER_HEAP_SIZE;
+        timer_heap = timer_heap ?
+                     MEM_REALLOC(timer_heap, timer_cap * sizeof(*timer_heap)) :
+                     MEM_ALLOC(mt_logic, NULL, timer_cap * sizeof(*timer_heap));
+    }
+    heap_place(s_room, timer_cnt++);
+    heap_sift_up(s_room->timer_idx);
+}
+
+void room_cancel_timer(server_room_t *s_room)
+{
+    int idx = s_room->timer_idx;
+    if (idx < 0)
+        return;
+
+    s_room->timer_idx = -1;
+    if (idx == --timer_cnt)
+        return;
+
+    // The last one takes the place and goes whichever way it has to
+    server_room_t *moved = timer_heap[timer_cnt];
+    heap_place(moved, idx);
+    heap_sift_up(idx);
+    heap_sift_down(moved->timer_idx);
+}
+
+long room_timers_run(long now_msec)
+{
+    // The callback may set the timer again, so it is taken off first
+    while (timer_cnt > 0 && timer_heap[0]->timer_due <= now_msec) {
+        server_room_t *s_room = timer_heap[0];
+        room_cancel_timer(s_room);
+        (*s_room->preset->timer_f)(s_room);
+    }
+
+    return timer_cnt > 0 ? timer_heap[0]->timer_due - now_msec : -1;
+}
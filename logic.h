@@ -5,6 +5,7 @@
 #include "defs.h"
 #include "chat.h"
 #include "utils.h"
+#include "mem_stats.h"
 
 // @NOTE: currently quite a lot of logic is common to hub, sudoku and fool
 //  (especially -- sudoku and fool). Concerning chat and tutorial, 
@@ -15,19 +16,53 @@
 
 typedef struct room_preset_tag room_preset_t;
 typedef struct room_session_tag room_session_t;
+typedef struct server_room_tag server_room_t;
 
-typedef struct server_room_tag {
+typedef void (*room_hook_func_t)(server_room_t *, void *ctx);
+
+struct server_room_tag {
     const room_preset_t *preset;
 
     char *name;
+    int id; // In the hub room registry, -1 if not registered
+
+    // Members, managed with room_add/remove_member. In ordered rooms (games)
+    //  the array order is the turn order and sess_cap is the seat count,
+    //  other rooms grow the array as needed
     room_session_t **sess_refs;
     int sess_cnt, sess_cap;
+    bool members_ordered;
 
     chat_t *chat;
     FILE *logs_file_handle;
 
     void *data;
-} server_room_t;
+
+    // Heap blocks and pooled objects owned by this room
+    mem_counters_t mem;
+
+    // Room sessions alive in the room (whether or not they are in sess_refs)
+    //  and sessions on their way in. changed_f is called whenever these,
+    //  sess_cnt or availability may have changed. Once both counts drop to
+    //  zero, vacated_f is called, and it may destroy the room
+    int resident_cnt, incoming_cnt;
+    room_hook_func_t changed_f;
+    room_hook_func_t vacated_f;
+    void *hook_ctx;
+
+    // Position in the hub matchmaking queue, mm_bucket is -1 if not queued
+    int mm_bucket, mm_idx;
+
+    // Logged-in users the server's presence index places here
+    int online_cnt;
+
+    // The room's timer (see room_set_timer), timer_idx is -1 if not set
+    long timer_due;
+    int timer_idx;
+};
+
+#define RESUME_TOKEN_BYTES   16
+#define RESUME_TOKEN_LEN     (2*RESUME_TOKEN_BYTES)
 
 typedef struct session_interface_tag {
     char *out_buf;
@@ -35,6 +70,20 @@ typedef struct session_interface_tag {
 
     server_room_t *next_room;
     bool need_to_register_username;
+    // Claimed by the hub at login, so that no one else gets in on the name
+    struct presence_entry_tag *presence;
+    // Set by the hub on "resume <token>" at the username prompt, the server
+    //  then hands the connection over to the detached session
+    char resume_req[RESUME_TOKEN_LEN+1];
+
+    // Kept here while the session is away in game rooms
+    long hub_chat_seen;
+
+    // Channels joined on top of the room chat, kept across room switches
+    chat_sub_t *channel_subs[CHAT_MAX_CHANNELS];
+    int channel_subs_cnt;
+
+    chat_flood_t chat_flood;
 
     bool quit;
 } session_interface_t;
@@ -47,6 +96,8 @@ typedef void (*init_sess_func_t)(room_session_t *);
 typedef void (*deinit_sess_func_t)(room_session_t *);
 typedef void (*state_process_line_func_t)(room_session_t *, const char *);
 typedef bool (*room_is_available_func_t)(server_room_t *);
+typedef void (*room_timer_func_t)(server_room_t *);
+typedef void (*resume_sess_func_t)(room_session_t *);
 
 struct room_preset_tag {
     const char *name;
@@ -58,14 +109,22 @@ struct room_preset_tag {
     deinit_sess_func_t         deinit_sess_f;
     state_process_line_func_t  process_line_f;
     room_is_available_func_t   room_is_available_f;
+    room_timer_func_t          timer_f; // Optional, for rooms that set timers
+    resume_sess_func_t         resume_f; // Optional, redraws the screen on resume
+
+    // Chat history depth and message length limit, 0 for the defaults
+    int chat_history_size;
+    int chat_msg_max_len;
 };
 
 struct room_session_tag {
     server_room_t *room;
     session_interface_t *interf;
 
-    char *username;
+    const char *username; // Interned handle, the room session holds a ref
     bool is_in_chat, is_in_tutorial;
+    chat_sub_t *room_sub; // To the room chat, for the whole stay
+    int member_idx; // In room->sess_refs, -1 if not a member
 
     void *data;
 };
@@ -75,18 +134,56 @@ server_room_t *make_room(const room_preset_t *preset, const char *id,
 void destroy_room(server_room_t *s_room);
 room_session_t *make_room_session(server_room_t *s_room,
                                   session_interface_t *interf,
-                                  char *username);
+                                  const char *username);
+// May end up destroying the room, if it is left vacated
 void destroy_room_session(room_session_t *r_sess);
 void room_session_process_line(room_session_t *r_sess, const char *line);
 
 // Not passing the line in, just process the event (like send smth and quit)
 void room_session_process_too_long_line(room_session_t *r_sess);
 
+// For init_room/deinit_room of presets
+void room_members_init(server_room_t *s_room, int cap, bool ordered);
+void room_members_deinit(server_room_t *s_room);
+// O(1), except for ordered removal, which shifts the (seat-capped) tail.
+//  Remove returns the index the session had, -1 if it was not a member
+void room_add_member(server_room_t *s_room, room_session_t *r_sess);
+int room_remove_member(server_room_t *s_room, room_session_t *r_sess);
+
+static inline bool room_is_member(room_session_t *r_sess)
+{
+    return r_sess->member_idx >= 0;
+}
+
+// Room switches must go through these, so that the target room is not
+//  reclaimed while the session is on its way in
+void set_next_room(session_interface_t *interf, server_room_t *room);
+void clear_next_room(session_interface_t *interf);
+
+// For games: room_is_available may have changed without anyone joining or
+//  leaving (e.g. the game has started or ended)
+void room_state_changed(server_room_t *s_room);
+
 static inline bool room_is_available(server_room_t *s_room)
 {
     return (*s_room->preset->room_is_available_f)(s_room);
 }
 
+// Every room can have one timer pending, which calls the preset's timer_f
+//  once it is due. Setting it again moves the deadline. Timers of all rooms
+//  sit in a binary heap by deadline, so setting and cancelling are
+//  O(log rooms) and finding the next due one is O(1)
+void room_set_timer(server_room_t *s_room, long delay_msec);
+void room_cancel_timer(server_room_t *s_room);
+
+// Called by the server once per loop iteration: fires the due timers and
+//  returns the msec until the next one, -1 if there are none
+long room_timers_run(long now_msec);
+
+// Unlike OUTBUF_POST*, keeps the output that is already queued
+void outbuf_append(session_interface_t *interf, const char *str, size_t len);
+void outbuf_appendf(session_interface_t *interf, const char *fmt, ...);
+
 // Universal utility thigys for posting responses
 #define OUTBUF_POST(_r_sess, _str) do { \
     if (_r_sess->interf->out_buf) free(_r_sess->interf->out_buf); \
@@ -110,8 +207,13 @@ static inline bool room_is_available(server_room_t *s_room)
 extern char clrscr[];
 
 typedef struct hub_payload_tag {
-    sized_array_t *logged_in_usernames;
-    const char *passwd_path;
+    struct presence_tag *presence; // Maintained by the server
+    const char *accounts_path;  // Prefix of the account store files
+    const char *passwd_path;    // Legacy text file, imported if there is no store yet
+    int max_rooms;              // Cap on concurrent game rooms
+    const char *chat_path;      // Ring file for the global chat, NULL to keep it in memory
+    const char *filter_path;    // Banned words for all chats, NULL for no filtering
+    const char *admin_username; // Allowed the admin commands, NULL for no admin
 } hub_payload_t;
 
 typedef struct game_payload_tag {
@@ -0,0 +1,91 @@
+/* TextGameServer/matchmaking.c */
+#include "matchmaking.h"
+
+void mm_init(mm_queue_t *q, const room_preset_t *preset)
+{
+    q->preset = preset;
+    for (int i = 0; i < MM_MAX_SEATS; i++)
+        svec_init(&q->buckets[i]);
+    q->top = 0;
+    q->rooms_cnt = 0;
+}
+
+void mm_deinit(mm_queue_t *q)
+{
+    for (int i = 0; i < MM_MAX_SEATS; i++)
+        svec_deinit(&q->buckets[i]);
+}
+
+void mm_remove(mm_queue_t *q, server_room_t *room)
+{
+    if (room->mm_bucket < 0)
+        return;
+
+    small_vec_t *bucket = &q->buckets[room->mm_bucket];
+    ASSERT(svec_at(bucket, room->mm_idx) == room);
+
+    svec_swap_remove(bucket, room->mm_idx);
+    server_room_t *moved = svec_at(bucket, room->mm_idx);
+    if (moved)
+        moved->mm_idx = room->mm_idx;
+
+    room->mm_bucket = -1;
+    room->mm_idx = -1;
+    q->rooms_cnt--;
+}
+
+static inline int occupancy(server_room_t *room)
+{
+    return room->sess_cnt + room->incoming_cnt;
+}
+
+static inline bool has_free_seat(server_room_t *room)
+{
+    return occupancy(room) < room->sess_cap && room_is_available(room);
+}
+
+void mm_update(mm_queue_t *q, server_room_t *room)
+{
+    ASSERT(room->preset == q->preset);
+
+    int occ = occupancy(room);
+    if (!has_free_seat(room) || occ >= MM_MAX_SEATS) {
+        mm_remove(q, room);
+        return;
+    }
+    if (room->mm_bucket == occ)
+        return;
+
+    mm_remove(q, room);
+
+    small_vec_t *bucket = &q->buckets[occ];
+    room->mm_bucket = occ;
+    room->mm_idx = bucket->size;
+    svec_push(bucket, room);
+    q->rooms_cnt++;
+
+    if (occ > q->top)
+        q->top = occ;
+}
+
+server_room_t *mm_pick(mm_queue_t *q)
+{
+    while (q->top >= 0) {
+        small_vec_t *bucket = &q->buckets[q->top];
+        if (svec_is_empty(bucket)) {
+            if (q->top == 0)
+                break;
+            q->top--;
+            continue;
+        }
+
+        server_room_t *room = svec_at(bucket, bucket->size-1);
+        if (has_free_seat(room))
+            return room;
+
+        // Stale: the room got closed without anyone joining or leaving
+        mm_remove(q, room);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,34 @@
+/* TextGameServer/matchmaking.h */
+#ifndef MATCHMAKING_SENTRY
+#define MATCHMAKING_SENTRY
+
+#include "defs.h"
+#include "logic.h"
+#include "utils.h"
+
+// Quickplay queue of joinable rooms for one game preset. Rooms are kept in
+//  buckets by occupancy (players in the room plus players on their way in),
+//  so the fullest joinable room is found by looking at a bounded number of
+//  buckets. The owner refiles a room with mm_update whenever its occupancy
+//  changes; availability changes without a membership change (e.g. a game
+//  being started) are caught lazily by mm_pick.
+
+#define MM_MAX_SEATS 32
+
+typedef struct mm_queue_tag {
+    const room_preset_t *preset;
+    small_vec_t buckets[MM_MAX_SEATS];  // Rooms by occupancy
+    int top;                            // No rooms in buckets above
+    int rooms_cnt;
+} mm_queue_t;
+
+// Must not be moved after init
+void mm_init(mm_queue_t *q, const room_preset_t *preset);
+void mm_deinit(mm_queue_t *q);
+
+void mm_update(mm_queue_t *q, server_room_t *room);
+void mm_remove(mm_queue_t *q, server_room_t *room);
+// Fullest room that can take one more player, NULL if there is none
+server_room_t *mm_pick(mm_queue_t *q);
+
+#endif
@@ -0,0 +1,247 @@
+/* TextGameServer/mem_stats.c */
+#include "mem_stats.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef union mem_header_tag {
+    struct {
+        size_t size;
+        mem_counters_t *owner;
+        int tag;
+        int site;
+    } h;
+    max_align_t align;
+} mem_header_t;
+
+static mem_counters_t tag_counters[mt_count] = { 0 };
+
+static const char *tag_names[mt_count] = {
+    [mt_server]  = "server",
+    [mt_logic]   = "logic",
+    [mt_hub]     = "hub",
+    [mt_chat]    = "chat",
+    [mt_fool]    = "fool",
+    [mt_sudoku]  = "sudoku",
+    [mt_names]   = "usernames",
+    [mt_accounts] = "accounts"
+};
+
+#ifdef MEM_DEBUG
+
+#define MAX_CALL_SITES  256
+#define SIZE_BUCKETS    16
+
+// Bucket 0 holds allocations under 16 bytes, bucket i -- [2^(i+3), 2^(i+4)),
+//  the last one -- all bigger
+typedef struct call_site_tag {
+    const char *file;
+    int line;
+    mem_tag_t tag;
+
+    long allocs;
+    long live_bytes;
+    long size_hist[SIZE_BUCKETS];
+} call_site_t;
+
+static call_site_t call_sites[MAX_CALL_SITES] = { 0 };
+
+static int size_bucket(size_t size)
+{
+    int b = 0;
+    for (size >>= 4; size && b < SIZE_BUCKETS-1; size >>= 1)
+        b++;
+    return b;
+}
+
+static int get_call_site(mem_tag_t tag, const char *file, int line)
+{
+    unsigned int h = (unsigned int) ((uintptr_t) file >> 4) * 31 + line;
+    for (int i = 0; i < MAX_CALL_SITES; i++) {
+        int idx = (h + i) % MAX_CALL_SITES;
+        call_site_t *cs = &call_sites[idx];
+        if (!cs->file) {
+            cs->file = file;
+            cs->line = line;
+            cs->tag = tag;
+            return idx;
+        } else if (cs->file == file && cs->line == line)
+            return idx;
+    }
+
+    return -1; // Table is full, stop tracking new sites
+}
+
+static void record_call_site(mem_header_t *hdr, const char *file, int line)
+{
+    hdr->h.site = get_call_site(hdr->h.tag, file, line);
+    if (hdr->h.site < 0)
+        return;
+
+    call_site_t *cs = &call_sites[hdr->h.site];
+    cs->allocs++;
+    cs->live_bytes += hdr->h.size;
+    cs->size_hist[size_bucket(hdr->h.size)]++;
+}
+
+static void forget_call_site(mem_header_t *hdr)
+{
+    if (hdr->h.site >= 0)
+        call_sites[hdr->h.site].live_bytes -= hdr->h.size;
+}
+
+#else
+
+#define record_call_site(_hdr, _file, _line) ((_hdr)->h.site = -1)
+#define forget_call_site(_hdr) NOOP
+
+#endif
+
+static void counters_add(mem_counters_t *mc, size_t size)
+{
+    mc->live_bytes += size;
+    mc->live_allocs++;
+    mc->total_allocs++;
+}
+
+static void counters_sub(mem_counters_t *mc, size_t size)
+{
+    mc->live_bytes -= size;
+    mc->live_allocs--;
+}
+
+void *mem_alloc_impl(mem_tag_t tag, mem_counters_t *owner, size_t size,
+                     const char *file, int line)
+{
+    ASSERT(tag >= 0 && tag < mt_count);
+
+    mem_header_t *hdr = malloc(sizeof(*hdr) + size);
+    ASSERT(hdr);
+    hdr->h.size = size;
+    hdr->h.owner = owner;
+    hdr->h.tag = tag;
+
+    counters_add(&tag_counters[tag], size);
+    if (owner)
+        counters_add(owner, size);
+    record_call_site(hdr, file, line);
+
+    return hdr + 1;
+}
+
+void *mem_calloc_impl(mem_tag_t tag, mem_counters_t *owner, size_t cnt, size_t size,
+                      const char *file, int line)
+{
+    void *p = mem_alloc_impl(tag, owner, cnt*size, file, line);
+    memset(p, 0, cnt*size);
+    return p;
+}
+
+void *mem_realloc_impl(void *p, size_t size, const char *file, int line)
+{
+    ASSERT(p);
+
+    mem_header_t *hdr = (mem_header_t *) p - 1;
+    size_t old_size = hdr->h.size;
+    forget_call_site(hdr);
+
+    hdr = realloc(hdr, sizeof(*hdr) + size);
+    ASSERT(hdr);
+    hdr->h.size = size;
+
+    tag_counters[hdr->h.tag].live_bytes += size - old_size;
+    if (hdr->h.owner)
+        hdr->h.owner->live_bytes += size - old_size;
+    record_call_site(hdr, file, line);
+
+    return hdr + 1;
+}
+
+char *mem_strdup_impl(mem_tag_t tag, mem_counters_t *owner, const char *s,
+                      const char *file, int line)
+{
+    size_t len = strlen(s);
+    char *res = mem_alloc_impl(tag, owner, len+1, file, line);
+    memcpy(res, s, len+1);
+    return res;
+}
+
+void mem_free(void *p)
+{
+    if (!p)
+        return;
+
+    mem_header_t *hdr = (mem_header_t *) p - 1;
+    counters_sub(&tag_counters[hdr->h.tag], hdr->h.size);
+    if (hdr->h.owner)
+        counters_sub(hdr->h.owner, hdr->h.size);
+    forget_call_site(hdr);
+
+    free(hdr);
+}
+
+void mem_charge(mem_counters_t *owner, size_t bytes)
+{
+    if (owner)
+        counters_add(owner, bytes);
+}
+
+void mem_uncharge(mem_counters_t *owner, size_t bytes)
+{
+    if (owner)
+        counters_sub(owner, bytes);
+}
+
+const mem_counters_t *mem_tag_counters(mem_tag_t tag)
+{
+    ASSERT(tag >= 0 && tag < mt_count);
+    return &tag_counters[tag];
+}
+
+void mem_sb_add_counters(string_builder_t *sb, const char *name, const mem_counters_t *mc)
+{
+    sb_add_strf(sb, "   %-16s %10ld B live in %6ld blocks (%ld allocated total)\r\n",
+                name, mc->live_bytes, mc->live_allocs, mc->total_allocs);
+}
+
+void mem_sb_add_subsystems(string_builder_t *sb)
+{
+    long tot = 0;
+    sb_add_str(sb, "Heap by subsystem:\r\n");
+    for (int i = 0; i < mt_count; i++) {
+        mem_sb_add_counters(sb, tag_names[i], &tag_counters[i]);
+        tot += tag_counters[i].live_bytes;
+    }
+    sb_add_strf(sb, "   total: %ld B\r\n", tot);
+}
+
+void mem_sb_add_pools(string_builder_t *sb)
+{
+    sb_add_str(sb, "Slab pools (object size, in use/capacity, slab bytes):\r\n");
+    for (mem_pool_t *p = pool_list_head(); p; p = p->next_pool) {
+        sb_add_strf(sb, "   %-24s %6zu B %6d/%-6d %10zu B\r\n",
+                    p->name, pool_elem_size(p), p->in_use, p->capacity,
+                    pool_elem_size(p) * p->capacity);
+    }
+}
+
+void mem_sb_add_call_sites(string_builder_t *sb)
+{
+#ifdef MEM_DEBUG
+    sb_add_str(sb, "Call sites (allocs, live bytes, size histogram <16B, <32B, <64B, ...):\r\n");
+    for (int i = 0; i < MAX_CALL_SITES; i++) {
+        call_site_t *cs = &call_sites[i];
+        if (!cs->file)
+            continue;
+
+        sb_add_strf(sb, "   %s:%d [%s] %ld %ld |", cs->file, cs->line,
+                    tag_names[cs->tag], cs->allocs, cs->live_bytes);
+        for (int b = 0; b < SIZE_BUCKETS; b++)
+            sb_add_strf(sb, " %ld", cs->size_hist[b]);
+        sb_add_str(sb, "\r\n");
+    }
+#else
+    sb_add_str(sb, "Call site histograms are only recorded with -DMEM_DEBUG\r\n");
+#endif
+}
@@ -0,0 +1,71 @@
+/* TextGameServer/mem_stats.h */
+#ifndef MEM_STATS_SENTRY
+#define MEM_STATS_SENTRY
+
+#include "defs.h"
+#include "utils.h"
+#include <stddef.h>
+
+// Tagged allocation wrappers. Every block carries a small header with its
+//  size, subsystem tag and (optionally) the counters of the room it belongs
+//  to, so that live bytes can be tracked per subsystem and per room.
+//  Blocks from mem_* must be freed with mem_free and nothing else.
+//  Building with -DMEM_DEBUG additionally records per-call-site histograms.
+
+typedef enum mem_tag_tag {
+    mt_server,
+    mt_logic,
+    mt_hub,
+    mt_chat,
+    mt_fool,
+    mt_sudoku,
+    mt_names,
+    mt_accounts,
+
+    mt_count
+} mem_tag_t;
+
+typedef struct mem_counters_tag {
+    long live_bytes;
+    long live_allocs;
+    long total_allocs;
+} mem_counters_t;
+
+void *mem_alloc_impl(mem_tag_t tag, mem_counters_t *owner, size_t size,
+                     const char *file, int line);
+void *mem_calloc_impl(mem_tag_t tag, mem_counters_t *owner, size_t cnt, size_t size,
+                      const char *file, int line);
+void *mem_realloc_impl(void *p, size_t size, const char *file, int line);
+char *mem_strdup_impl(mem_tag_t tag, mem_counters_t *owner, const char *s,
+                      const char *file, int line);
+void mem_free(void *p);
+
+#define MEM_ALLOC(_tag, _owner, _size) \
+    mem_alloc_impl(_tag, _owner, _size, __FILE__, __LINE__)
+#define MEM_CALLOC(_tag, _owner, _cnt, _size) \
+    mem_calloc_impl(_tag, _owner, _cnt, _size, __FILE__, __LINE__)
+#define MEM_REALLOC(_p, _size) \
+    mem_realloc_impl(_p, _size, __FILE__, __LINE__)
+#define MEM_STRDUP(_tag, _owner, _s) \
+    mem_strdup_impl(_tag, _owner, _s, __FILE__, __LINE__)
+
+// Account pooled objects to an owner (pool slabs themselves are reported per pool)
+void mem_charge(mem_counters_t *owner, size_t bytes);
+void mem_uncharge(mem_counters_t *owner, size_t bytes);
+
+static inline void mem_counters_init(mem_counters_t *mc)
+{
+    mc->live_bytes = 0;
+    mc->live_allocs = 0;
+    mc->total_allocs = 0;
+}
+
+const mem_counters_t *mem_tag_counters(mem_tag_t tag);
+
+// Human-readable dumps for the admin command
+void mem_sb_add_subsystems(string_builder_t *sb);
+void mem_sb_add_pools(string_builder_t *sb);
+void mem_sb_add_counters(string_builder_t *sb, const char *name, const mem_counters_t *mc);
+void mem_sb_add_call_sites(string_builder_t *sb);
+
+#endif
@@ -0,0 +1,77 @@
+/* TextGameServer/passwd_hash.c */
+#include "passwd_hash.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <crypt.h>
+
+#define HASH_PREFIX     "$6$"
+#define SALT_LEN        16
+
+static const char salt_chars[] =
+    "./0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+static bool gen_salt(char *dest)
+{
+    unsigned char rnd[SALT_LEN];
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = read(fd, rnd, sizeof(rnd)) == sizeof(rnd);
+    close(fd);
+    if (!ok)
+        return false;
+
+    char *p = dest;
+    memcpy(p, HASH_PREFIX, sizeof(HASH_PREFIX)-1);
+    p += sizeof(HASH_PREFIX)-1;
+    for (int i = 0; i < SALT_LEN; i++)
+        *p++ = salt_chars[rnd[i] % (sizeof(salt_chars)-1)];
+    *p++ = '$';
+    *p = '\0';
+    return true;
+}
+
+bool ph_hash(const char *passwd, char *out, size_t out_size)
+{
+    char salt[sizeof(HASH_PREFIX) + SALT_LEN + 1];
+    if (!gen_salt(salt))
+        return false;
+
+    struct crypt_data cd;
+    memset(&cd, 0, sizeof(cd));
+    const char *res = crypt_r(passwd, salt, &cd);
+    if (!res || res[0] != '$' || strlen(res) >= out_size)
+        return false;
+
+    strcpy(out, res);
+    return true;
+}
+
+// Does not stop at the first mismatch, so the timing tells nothing
+static bool const_time_eq(const char *s1, const char *s2)
+{
+    size_t l1 = strlen(s1), l2 = strlen(s2);
+    unsigned char diff = l1 != l2;
+    for (size_t i = 0; i < l1 && i < l2; i++)
+        diff |= s1[i] ^ s2[i];
+    return diff == 0;
+}
+
+bool ph_verify(const char *stored, const char *passwd)
+{
+    if (!ph_is_hashed(stored))
+        return const_time_eq(stored, passwd);
+
+    struct crypt_data cd;
+    memset(&cd, 0, sizeof(cd));
+    const char *res = crypt_r(passwd, stored, &cd);
+    return res && res[0] == '$' && const_time_eq(stored, res);
+}
+
+bool ph_is_hashed(const char *stored)
+{
+    return strncmp(stored, HASH_PREFIX, sizeof(HASH_PREFIX)-1) == 0;
+}
@@ -0,0 +1,19 @@
+/* TextGameServer/passwd_hash.h */
+#ifndef PASSWD_HASH_SENTRY
+#define PASSWD_HASH_SENTRY
+
+#include "defs.h"
+#include <stddef.h>
+
+// Password hashing with crypt(3) SHA-512 ("$6$<salt>$<hash>"). Stored
+//  values without the prefix are legacy plaintext passwords, which still
+//  verify and should be rehashed by the caller. Both operations take
+//  milliseconds by design, so call them from a worker thread. Thread-safe.
+
+#define PH_HASH_MAX_LEN 128
+
+bool ph_hash(const char *passwd, char *out, size_t out_size);
+bool ph_verify(const char *stored, const char *passwd);
+bool ph_is_hashed(const char *stored);
+
+#endif
@@ -0,0 +1,99 @@
+/* TextGameServer/presence.c */
+#include "presence.h"
+#include "usernames.h"
+#include "mem_stats.h"
+
+#define INIT_ENTRIES_SIZE   32
+#define ENTRIES_PER_SLAB    INIT_ENTRIES_SIZE
+
+static mem_pool_t entry_pool = MEM_POOL_INITIALIZER(presence_entry_t, ENTRIES_PER_SLAB);
+
+void pres_init(presence_t *pres)
+{
+    hm_init(&pres->by_name, INIT_ENTRIES_SIZE);
+    pres->size = 0;
+    pres->cap = INIT_ENTRIES_SIZE;
+    pres->entries = MEM_ALLOC(mt_server, NULL, pres->cap * sizeof(*pres->entries));
+}
+
+void pres_deinit(presence_t *pres)
+{
+    while (pres->size > 0)
+        pres_remove(pres, pres->entries[pres->size-1]);
+    hm_deinit(&pres->by_name);
+    mem_free(pres->entries);
+}
+
+presence_entry_t *pres_add(presence_t *pres, const char *username,
+                           room_session_t *r_sess)
+{
+    if (hm_contains(&pres->by_name, username))
+        return NULL;
+
+    presence_entry_t *entry = pool_alloc(&entry_pool);
+    entry->username = uname_retain(username);
+    entry->room = NULL;
+    entry->state = pst_online;
+    pres_set_room(entry, r_sess->room);
+    pres_set_session(entry, r_sess);
+
+    if (pres->size >= pres->cap) {
+        pres->cap *= 2;
+        pres->entries = MEM_REALLOC(pres->entries, pres->cap * sizeof(*pres->entries));
+    }
+    entry->idx = pres->size;
+    pres->entries[pres->size++] = entry;
+    hm_put(&pres->by_name, entry->username, entry);
+
+    return entry;
+}
+
+// Order is not preserved: the last entry takes the removed one's place
+void pres_remove(presence_t *pres, presence_entry_t *entry)
+{
+    ASSERT(entry->idx >= 0 && entry->idx < pres->size && pres->entries[entry->idx] == entry);
+
+    presence_entry_t *moved = pres->entries[--pres->size];
+    pres->entries[entry->idx] = moved;
+    moved->idx = entry->idx;
+
+    hm_remove(&pres->by_name, entry->username);
+    pres_set_room(entry, NULL);
+    uname_release(entry->username);
+    pool_free(&entry_pool, entry);
+}
+
+presence_entry_t *pres_find(presence_t *pres, const char *username)
+{
+    return hm_get(&pres->by_name, username);
+}
+
+void pres_set_room(presence_entry_t *entry, server_room_t *room)
+{
+    if (entry->room)
+        entry->room->online_cnt--;
+    entry->room = room;
+    entry->r_sess = NULL;
+    if (room)
+        room->online_cnt++;
+}
+
+void pres_set_state(presence_entry_t *entry, presence_state_t state)
+{
+    entry->state = state;
+}
+
+void pres_sb_add_page(presence_t *pres, string_builder_t *sb, int page)
+{
+    ASSERT(page >= 0 && page <= pres->size / PRES_PAGE_SIZE);
+
+    int from = page * PRES_PAGE_SIZE;
+    int to = from + PRES_PAGE_SIZE < pres->size ? from + PRES_PAGE_SIZE : pres->size;
+    for (int i = from; i < to; i++) {
+        presence_entry_t *entry = pres->entries[i];
+        const char *where = entry->room->name[0] ? entry->room->name : "hub"; // Hub is nameless
+        sb_add_strf(sb, "   %-16s %s (%d there)%s\r\n", entry->username,
+                    where, entry->room->online_cnt,
+                    entry->state == pst_away ? ", away" : "");
+    }
+}
@@ -0,0 +1,60 @@
+/* TextGameServer/presence.h */
+#ifndef PRESENCE_SENTRY
+#define PRESENCE_SENTRY
+
+#include "defs.h"
+#include "logic.h"
+#include "utils.h"
+
+// Who is online and where. The server keeps an entry per logged-in user,
+//  moving it along at every room switch and dropping it at disconnect.
+//  Entries are indexed by username and sit in a dense list for paging, and
+//  every room counts the entries pointing at it, so all updates are O(1).
+//  The entry also leads to the user's room session, for direct delivery.
+
+#define PRES_PAGE_SIZE 20
+
+typedef enum presence_state_tag {
+    pst_online,
+    pst_away        // Connection dropped, the seat is kept for a resume
+} presence_state_t;
+
+typedef struct presence_entry_tag {
+    const char *username;   // Interned handle, the entry holds a ref
+    room_session_t *r_sess; // NULL while switching rooms
+    server_room_t *room;
+    presence_state_t state;
+    int idx;                // In the dense list
+} presence_entry_t;
+
+typedef struct presence_tag {
+    hash_map_t by_name;
+    presence_entry_t **entries;
+    int size, cap;
+} presence_t;
+
+void pres_init(presence_t *pres);
+void pres_deinit(presence_t *pres);
+
+// Returns NULL if the user already has an entry
+presence_entry_t *pres_add(presence_t *pres, const char *username,
+                           room_session_t *r_sess);
+void pres_remove(presence_t *pres, presence_entry_t *entry);
+presence_entry_t *pres_find(presence_t *pres, const char *username);
+
+// The entry must be moved off a room before the room can be destroyed.
+//  Moving clears the room session, set it again once it is made
+void pres_set_room(presence_entry_t *entry, server_room_t *room);
+
+static inline void pres_set_session(presence_entry_t *entry, room_session_t *r_sess)
+{
+    ASSERT(r_sess->room == entry->room);
+    entry->r_sess = r_sess;
+}
+void pres_set_state(presence_entry_t *entry, presence_state_t state);
+
+static inline int pres_count(presence_t *pres) { return pres->size; }
+// Pages start from 0 and must exist (the caller clamps user input)
+void pres_sb_add_page(presence_t *pres, string_builder_t *sb, int page);
+
+#endif
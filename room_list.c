@@ -0,0 +1,178 @@
+/* TextGameServer/room_list.c */
+#include "room_list.h"
+#include "mem_stats.h"
+#include <stdio.h>
+#include <string.h>
+
+#define INIT_LIST_SIZE 16
+
+// Slots of the summary positions, one per list a room can be in
+enum { lp_all, lp_all_open, lp_game, lp_game_open, lp_count };
+
+struct room_summary_tag {
+    server_room_t *room;
+    int game_idx;
+    bool open;
+    char line[RL_LINE_MAX_LEN];
+
+    int pos[lp_count];  // -1 if not in the list
+};
+
+static void list_init(rl_list_t *l, int pos_slot, mem_counters_t *owner)
+{
+    l->size = 0;
+    l->cap = INIT_LIST_SIZE;
+    l->items = MEM_ALLOC(mt_hub, owner, l->cap * sizeof(*l->items));
+    l->pos_slot = pos_slot;
+}
+
+static void list_push(rl_list_t *l, room_summary_t *rs)
+{
+    if (l->size >= l->cap) {
+        l->cap *= 2;
+        l->items = MEM_REALLOC(l->items, l->cap * sizeof(*l->items));
+    }
+    rs->pos[l->pos_slot] = l->size;
+    l->items[l->size++] = rs;
+}
+
+// Order is not preserved: the last summary takes the removed one's place
+static void list_remove(rl_list_t *l, room_summary_t *rs)
+{
+    int pos = rs->pos[l->pos_slot];
+    ASSERT(pos >= 0 && pos < l->size && l->items[pos] == rs);
+
+    room_summary_t *moved = l->items[--l->size];
+    l->items[pos] = moved;
+    moved->pos[l->pos_slot] = pos;
+    rs->pos[l->pos_slot] = -1;
+}
+
+static inline rl_list_t *game_list(room_list_t *rl, int game_idx, int open)
+{
+    return &rl->per_game[game_idx*2 + open];
+}
+
+void rl_init(room_list_t *rl, int num_games, mem_counters_t *owner)
+{
+    rl->owner = owner;
+    rl->num_games = num_games;
+    rl->by_id_cap = INIT_LIST_SIZE;
+    rl->by_id = MEM_CALLOC(mt_hub, owner, rl->by_id_cap, sizeof(*rl->by_id));
+
+    for (int open = 0; open < 2; open++)
+        list_init(&rl->all[open], open ? lp_all_open : lp_all, owner);
+    rl->per_game = MEM_ALLOC(mt_hub, owner, num_games * 2 * sizeof(*rl->per_game));
+    for (int i = 0; i < num_games; i++) {
+        for (int open = 0; open < 2; open++)
+            list_init(game_list(rl, i, open), open ? lp_game_open : lp_game, owner);
+    }
+}
+
+void rl_deinit(room_list_t *rl)
+{
+    for (int i = 0; i < rl->by_id_cap; i++) {
+        if (rl->by_id[i])
+            mem_free(rl->by_id[i]);
+    }
+    mem_free(rl->by_id);
+
+    for (int i = 0; i < 2; i++)
+        mem_free(rl->all[i].items);
+    for (int i = 0; i < rl->num_games * 2; i++)
+        mem_free(rl->per_game[i].items);
+    mem_free(rl->per_game);
+}
+
+static void set_open(room_list_t *rl, room_summary_t *rs, bool open)
+{
+    if (rs->open == open)
+        return;
+
+    if (rs->open) {
+        list_remove(&rl->all[1], rs);
+        list_remove(game_list(rl, rs->game_idx, 1), rs);
+    } else {
+        list_push(&rl->all[1], rs);
+        list_push(game_list(rl, rs->game_idx, 1), rs);
+    }
+    rs->open = open;
+}
+
+void rl_add(room_list_t *rl, server_room_t *room, int game_idx)
+{
+    ASSERT(room->id >= 0);
+    ASSERT(game_idx >= 0 && game_idx < rl->num_games);
+
+    if (room->id >= rl->by_id_cap) {
+        int new_cap = rl->by_id_cap;
+        while (room->id >= new_cap)
+            new_cap *= 2;
+        rl->by_id = MEM_REALLOC(rl->by_id, new_cap * sizeof(*rl->by_id));
+        for (int i = rl->by_id_cap; i < new_cap; i++)
+            rl->by_id[i] = NULL;
+        rl->by_id_cap = new_cap;
+    }
+    ASSERT(!rl->by_id[room->id]);
+
+    room_summary_t *rs = MEM_ALLOC(mt_hub, rl->owner, sizeof(*rs));
+    rs->room = room;
+    rs->game_idx = game_idx;
+    rs->open = false;
+    for (int i = 0; i < lp_count; i++)
+        rs->pos[i] = -1;
+    list_push(&rl->all[0], rs);
+    list_push(game_list(rl, game_idx, 0), rs);
+    rl->by_id[room->id] = rs;
+
+    rl_update(rl, room);
+}
+
+void rl_update(room_list_t *rl, server_room_t *room)
+{
+    room_summary_t *rs = room->id >= 0 && room->id < rl->by_id_cap ? rl->by_id[room->id] : NULL;
+    if (!rs || rs->room != room)
+        return;
+
+    bool available = room_is_available(room);
+    snprintf(rs->line, sizeof(rs->line), "   %s %d/%d %s\r\n", room->name,
+             room->sess_cnt, room->sess_cap, available ? "" : "(closed)");
+    set_open(rl, rs, available);
+}
+
+void rl_remove(room_list_t *rl, server_room_t *room)
+{
+    room_summary_t *rs = room->id >= 0 && room->id < rl->by_id_cap ? rl->by_id[room->id] : NULL;
+    if (!rs || rs->room != room)
+        return;
+
+    set_open(rl, rs, false);
+    list_remove(&rl->all[0], rs);
+    list_remove(game_list(rl, rs->game_idx, 0), rs);
+
+    rl->by_id[room->id] = NULL;
+    mem_free(rs);
+}
+
+static inline rl_list_t *filtered_list(room_list_t *rl, int game_idx, bool open_only)
+{
+    return game_idx >= 0 ? game_list(rl, game_idx, open_only) : &rl->all[open_only];
+}
+
+int rl_count(room_list_t *rl, int game_idx, bool open_only)
+{
+    return filtered_list(rl, game_idx, open_only)->size;
+}
+
+void rl_sb_add_page(room_list_t *rl, string_builder_t *sb,
+                    int game_idx, bool open_only, int page)
+{
+    rl_list_t *l = filtered_list(rl, game_idx, open_only);
+
+    ASSERT(page >= 0 && page <= l->size / RL_PAGE_SIZE);
+
+    int from = page * RL_PAGE_SIZE;
+    int to = from + RL_PAGE_SIZE < l->size ? from + RL_PAGE_SIZE : l->size;
+    for (int i = from; i < to; i++)
+        sb_add_str(sb, l->items[i]->line);
+}
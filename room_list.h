@@ -0,0 +1,50 @@
+/* TextGameServer/room_list.h */
+#ifndef ROOM_LIST_SENTRY
+#define ROOM_LIST_SENTRY
+
+#include "defs.h"
+#include "logic.h"
+#include "utils.h"
+
+// Cached summaries of the hub's game rooms for <listr>. Each room has a
+//  preformatted line that is only rebuilt when the room changes, and sits in
+//  dense lists for every filter combination (all/one game x any/open), so a
+//  page is produced by copying page-size lines, regardless of room count.
+
+#define RL_PAGE_SIZE        20
+#define RL_LINE_MAX_LEN     96
+
+typedef struct room_summary_tag room_summary_t;
+
+typedef struct rl_list_tag {
+    room_summary_t **items;
+    int size, cap;
+    int pos_slot;           // Which of the summary's positions is for this list
+} rl_list_t;
+
+typedef struct room_list_tag {
+    room_summary_t **by_id; // Indexed by room id
+    int by_id_cap;
+
+    int num_games;
+    rl_list_t all[2];       // [open]
+    rl_list_t *per_game;    // [game*2 + open]
+
+    mem_counters_t *owner;
+} room_list_t;
+
+void rl_init(room_list_t *rl, int num_games, mem_counters_t *owner);
+void rl_deinit(room_list_t *rl);
+
+// The room must have its registry id. game_idx is a filter key of the caller
+void rl_add(room_list_t *rl, server_room_t *room, int game_idx);
+void rl_update(room_list_t *rl, server_room_t *room);
+void rl_remove(room_list_t *rl, server_room_t *room);
+
+// game_idx < 0 for all games, pages start from 0 and must exist (the
+//  caller clamps user input)
+int rl_count(room_list_t *rl, int game_idx, bool open_only);
+void rl_sb_add_page(room_list_t *rl, string_builder_t *sb,
+                    int game_idx, bool open_only, int page);
+
+#endif
@@ -7,26 +7,33 @@
 static const room_preset_t hub_preset = {
     .name                 = "",
 
-    .init_subs_f          = NULL,
+    .init_subs_f          = &hub_init_subsystems,
     .init_room_f          = &hub_init_room,
     .deinit_room_f        = &hub_deinit_room,
     .init_sess_f          = &hub_init_room_session,
     .deinit_sess_f        = &hub_deinit_room_session,
     .process_line_f       = &hub_process_line,
-    .room_is_available_f  = &hub_is_available
+    .room_is_available_f  = &hub_is_available,
+    .timer_f              = NULL,
+    .resume_f             = NULL,
+
+    .chat_history_size    = 256,
+    .chat_msg_max_len     = 128
 };
 
 static const room_preset_t game_presets[] = {
     {
         .name                 = "fool",
 
-        .init_subs_f          = NULL,
+        .init_subs_f          = &fool_init_subsystems,
         .init_room_f          = &fool_init_room,
         .deinit_room_f        = &fool_deinit_room,
         .init_sess_f          = &fool_init_room_session,
         .deinit_sess_f        = &fool_deinit_room_session,
         .process_line_f       = &fool_process_line,
-        .room_is_available_f  = &fool_room_is_available
+        .room_is_available_f  = &fool_room_is_available,
+        .timer_f              = &fool_turn_timed_out,
+        .resume_f             = &fool_resume_room_session
     }, 
     {
         .name                 = "sudoku",
@@ -37,7 +44,9 @@ static const room_preset_t game_presets[] = {
         .init_sess_f          = &sudoku_init_room_session,
         .deinit_sess_f        = &sudoku_deinit_room_session,
         .process_line_f       = &sudoku_process_line,
-        .room_is_available_f  = &sudoku_room_is_available
+        .room_is_available_f  = &sudoku_room_is_available,
+        .timer_f              = &sudoku_turn_timed_out,
+        .resume_f             = &sudoku_resume_room_session
     }
 };
 #define NUM_GAMES (sizeof(game_presets)/sizeof(*game_presets))
@@ -0,0 +1,84 @@
+/* TextGameServer/room_registry.c */
+#include "room_registry.h"
+#include "mem_stats.h"
+
+#define INIT_SLOTS_SIZE 16
+
+void rreg_init(room_registry_t *rreg, int max_rooms, mem_counters_t *owner)
+{
+    ASSERT(max_rooms > 0);
+
+    rreg->max_rooms = max_rooms;
+    rreg->owner = owner;
+    rreg->slots_cnt = 0;
+    rreg->slots_cap = INIT_SLOTS_SIZE < max_rooms ? INIT_SLOTS_SIZE : max_rooms;
+    rreg->slots = MEM_CALLOC(mt_hub, owner, rreg->slots_cap, sizeof(*rreg->slots));
+    rreg->free_ids = MEM_ALLOC(mt_hub, owner, rreg->slots_cap * sizeof(*rreg->free_ids));
+    rreg->free_cnt = 0;
+    rreg->rooms_cnt = 0;
+    hm_init(&rreg->by_name, INIT_SLOTS_SIZE);
+}
+
+void rreg_deinit(room_registry_t *rreg)
+{
+    mem_free(rreg->slots);
+    mem_free(rreg->free_ids);
+    hm_deinit(&rreg->by_name);
+}
+
+int rreg_reserve_id(room_registry_t *rreg)
+{
+    if (rreg->free_cnt > 0)
+        return rreg->free_ids[--rreg->free_cnt];
+    if (rreg->slots_cnt >= rreg->max_rooms)
+        return -1;
+
+    if (rreg->slots_cnt >= rreg->slots_cap) {
+        int new_cap = rreg->slots_cap * 2;
+        if (new_cap > rreg->max_rooms)
+            new_cap = rreg->max_rooms;
+
+        rreg->slots = MEM_REALLOC(rreg->slots, new_cap * sizeof(*rreg->slots));
+        rreg->free_ids = MEM_REALLOC(rreg->free_ids, new_cap * sizeof(*rreg->free_ids));
+        for (int i = rreg->slots_cap; i < new_cap; i++)
+            rreg->slots[i] = NULL;
+        rreg->slots_cap = new_cap;
+    }
+
+    return rreg->slots_cnt++;
+}
+
+void rreg_add(room_registry_t *rreg, int id, server_room_t *room)
+{
+    ASSERT(id >= 0 && id < rreg->slots_cnt && !rreg->slots[id]);
+
+    room->id = id;
+    rreg->slots[id] = room;
+    rreg->rooms_cnt++;
+    hm_put(&rreg->by_name, room->name, room);
+}
+
+void rreg_remove(room_registry_t *rreg, server_room_t *room)
+{
+    ASSERT(rreg_at(rreg, room->id) == room);
+
+    hm_remove(&rreg->by_name, room->name);
+    rreg->slots[room->id] = NULL;
+    rreg->free_ids[rreg->free_cnt++] = room->id;
+    rreg->rooms_cnt--;
+    room->id = -1;
+}
+
+server_room_t *rreg_find(room_registry_t *rreg, const char *name)
+{
+    return hm_get(&rreg->by_name, name);
+}
+
+int rreg_next(room_registry_t *rreg, int id)
+{
+    for (id++; id < rreg->slots_cnt; id++) {
+        if (rreg->slots[id])
+            return id;
+    }
+    return -1;
+}
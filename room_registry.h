@@ -0,0 +1,45 @@
+/* TextGameServer/room_registry.h */
+#ifndef ROOM_REGISTRY_SENTRY
+#define ROOM_REGISTRY_SENTRY
+
+#include "defs.h"
+#include "logic.h"
+#include "utils.h"
+
+// Game rooms of the hub. Each room gets an id (ids of gone rooms are reused
+//  through a free list), which is also its name suffix, and rooms are
+//  indexed by name. Reserving an id, adding, removing and finding by name
+//  are O(1); iteration walks the id slots.
+
+typedef struct room_registry_tag {
+    server_room_t **slots;  // Indexed by room id, NULL if free
+    int slots_cnt, slots_cap;
+    int max_rooms;
+    int rooms_cnt;
+
+    int *free_ids;          // Stack of freed ids below slots_cnt
+    int free_cnt;
+
+    hash_map_t by_name;
+    mem_counters_t *owner;
+} room_registry_t;
+
+void rreg_init(room_registry_t *rreg, int max_rooms, mem_counters_t *owner);
+// Does not destroy the remaining rooms
+void rreg_deinit(room_registry_t *rreg);
+
+// Returns -1 if the cap is reached. The id must then be used in rreg_add
+int rreg_reserve_id(room_registry_t *rreg);
+void rreg_add(room_registry_t *rreg, int id, server_room_t *room);
+void rreg_remove(room_registry_t *rreg, server_room_t *room);
+server_room_t *rreg_find(room_registry_t *rreg, const char *name);
+
+// Iteration: for (int i = rreg_next(rreg, -1); i >= 0; i = rreg_next(rreg, i))
+int rreg_next(room_registry_t *rreg, int id);
+
+static inline server_room_t *rreg_at(room_registry_t *rreg, int id)
+{
+    return id >= 0 && id < rreg->slots_cnt ? rreg->slots[id] : NULL;
+}
+
+#endif
@@ -3,11 +3,18 @@
 #include "utils.h"
 #include "logic.h"
 #include "room_presets.h"
+#include "mem_stats.h"
+#include "usernames.h"
+#include "completion_queue.h"
+#include "worker_pool.h"
+#include "presence.h"
+#include "chat_funcs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -19,6 +26,12 @@
 #define INIT_SESS_ARR_SIZE   32
 #define INIT_ROOMS_ARR_SIZE  4
 #define INBUFSIZE            1024
+#define DEFAULT_MAX_ROOMS    16384
+#define SESSIONS_PER_SLAB    INIT_SESS_ARR_SIZE
+
+// A player whose connection drops in a game room keeps the seat this long,
+//  and can take it back from a new connection with the resume token
+#define RESUME_GRACE_SEC     60
 
 typedef struct session_tag {
     int fd;
@@ -27,7 +40,13 @@ typedef struct session_tag {
 
     session_interface_t interf;
     room_session_t *rs;
-    char *username;
+    const char *username; // Interned handle, set once logged in
+
+    // Issued at login. While detached, the session has no fd and lives in
+    //  the detached list until resumed or past its deadline
+    char resume_token[RESUME_TOKEN_LEN+1];
+    bool detached;
+    long detach_deadline;
 } session;
 
 typedef struct server_tag {
@@ -37,16 +56,25 @@ typedef struct server_tag {
 
     // Custom logic
     server_room_t *hub;
-    sized_array_t logged_in_usernames;
+    // Everyone past the login
+    presence_t presence;
+    // Resume token -> session, and the sessions waiting to be resumed
+    hash_map_t resume_tokens;
+    small_vec_t detached;
     FILE *result_logs_f;
 } server;
 
+static const char accounts_path[] = "./passwd";
 static const char passwd_path[] = "./passwd.txt";
 static const char logs_path[] = "./res_logs.txt";
+static const char chat_path[] = "./hub_chat.ring";
+static const char filter_path[] = "./chat_filter.txt";
+
+static mem_pool_t session_pool = MEM_POOL_INITIALIZER(session, SESSIONS_PER_SLAB);
 
 session *make_session(int fd, server_room_t *room)
 {
-    session *sess = malloc(sizeof(*sess));
+    session *sess = pool_alloc(&session_pool);
     sess->fd = fd;
     sess->buf_used = 0;
 
@@ -54,9 +82,17 @@ session *make_session(int fd, server_room_t *room)
     sess->interf.out_buf_len = 0;
     sess->interf.next_room = NULL;
     sess->interf.need_to_register_username = false;
+    sess->interf.presence = NULL;
+    sess->interf.hub_chat_seen = 0;
+    sess->interf.channel_subs_cnt = 0;
+    chat_flood_init(&sess->interf.chat_flood);
     sess->interf.quit = false;
 
     sess->username = NULL;
+    sess->resume_token[0] = '\0';
+    sess->interf.resume_req[0] = '\0';
+    sess->detached = false;
+    sess->detach_deadline = 0;
     sess->rs = make_room_session(room, &sess->interf, sess->username);
     return sess;
 }
@@ -65,7 +101,9 @@ void cleanup_session(session *sess)
 {
     if (sess->interf.out_buf) free(sess->interf.out_buf);
     if (sess->rs) destroy_room_session(sess->rs);
-    if (sess->username) free(sess->username);
+    chat_leave_channels(&sess->interf);
+    clear_next_room(&sess->interf);
+    uname_release(sess->username);
 }
 
 void session_check_lf(session *sess)
@@ -137,12 +175,19 @@ void switch_session_room(server *serv, session *sess)
 {
     ASSERT(sess->interf.next_room);
 
+    server_room_t *next_room = sess->interf.next_room;
+    if (sess->interf.presence)
+        pres_set_room(sess->interf.presence, next_room);
     destroy_room_session(sess->rs);
-    sess->rs = make_room_session(sess->interf.next_room, &sess->interf, sess->username);
-    sess->interf.next_room = NULL;
+    sess->rs = make_room_session(next_room, &sess->interf, sess->username);
+    if (sess->interf.presence)
+        pres_set_session(sess->interf.presence, sess->rs);
+    // Unless the room has already sent the session on (e.g. it is full)
+    if (sess->interf.next_room == next_room)
+        clear_next_room(&sess->interf);
 }
 
-void server_init(server *serv, int port)
+void server_init(server *serv, int port, int max_rooms, const char *admin_username)
 {
     int sock, opt;
     struct sockaddr_in addr;
@@ -162,21 +207,27 @@ void server_init(server *serv, int port)
     listen(sock, LISTEN_QLEN);
     serv->ls = sock;
 
-    serv->sessions = calloc(INIT_SESS_ARR_SIZE, sizeof(*serv->sessions));
+    serv->sessions = MEM_CALLOC(mt_server, NULL, INIT_SESS_ARR_SIZE, sizeof(*serv->sessions));
     serv->sessions_size = INIT_SESS_ARR_SIZE;
 
     serv->result_logs_f = fopen(logs_path, "a");
     ASSERT(serv->result_logs_f);
 
+    pres_init(&serv->presence);
+    hm_init(&serv->resume_tokens, INIT_SESS_ARR_SIZE);
+    svec_init(&serv->detached);
+
     hub_payload_t payload = { 
-        .logged_in_usernames = &serv->logged_in_usernames, 
-        .passwd_path = passwd_path
+        .presence = &serv->presence,
+        .accounts_path = accounts_path,
+        .passwd_path = passwd_path,
+        .max_rooms = max_rooms,
+        .chat_path = chat_path,
+        .filter_path = filter_path,
+        .admin_username = admin_username
     };
     serv->hub = make_room(&hub_preset, NULL, serv->result_logs_f, &payload);
     ASSERT(serv->hub);
-
-    serv->logged_in_usernames.data = calloc(INIT_SESS_ARR_SIZE, sizeof(*serv->logged_in_usernames.data));
-    serv->logged_in_usernames.size = INIT_SESS_ARR_SIZE;
 }
 
 void server_accept_client(server *serv)
@@ -195,55 +246,188 @@ void server_accept_client(server *serv)
         while (newsize <= sd)
             newsize += INIT_SESS_ARR_SIZE;
         serv->sessions = 
-            realloc(serv->sessions, newsize * sizeof(*serv->sessions));
-        serv->logged_in_usernames.data = 
-            realloc(serv->logged_in_usernames.data,
-                    newsize * sizeof(*serv->logged_in_usernames.data));
+            MEM_REALLOC(serv->sessions, newsize * sizeof(*serv->sessions));
         for (int i = serv->sessions_size; i < newsize; i++)
             serv->sessions[i] = NULL;
         serv->sessions_size = newsize;
-        serv->logged_in_usernames.size = newsize;
     }
 
     serv->sessions[sd] = make_session(sd, serv->hub);
     ASSERT(serv->sessions[sd]);
 }
 
+static bool gen_resume_token(char *dest)
+{
+    unsigned char rnd[RESUME_TOKEN_BYTES];
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = read(fd, rnd, sizeof(rnd)) == sizeof(rnd);
+    close(fd);
+
+    for (int i = 0; ok && i < RESUME_TOKEN_BYTES; i++)
+        sprintf(dest + 2*i, "%02x", rnd[i]);
+    return ok;
+}
+
+// The hub has claimed the presence entry by now, what is left is the token
+void server_register_user(server *serv, session *sess)
+{
+    sess->username = uname_retain(sess->rs->username);
+
+    if (!gen_resume_token(sess->resume_token)) {
+        sess->resume_token[0] = '\0';
+        return;
+    }
+    hm_put(&serv->resume_tokens, sess->resume_token, sess);
+
+    char msg[256];
+    sprintf(msg, "Your resume token is %s. If your connection drops during a game, "
+                 "reconnect and enter <resume %s> instead of the username within %d seconds\r\n",
+                 sess->resume_token, sess->resume_token, RESUME_GRACE_SEC);
+    outbuf_append(&sess->interf, msg, strlen(msg));
+}
+
+// Final cleanup for both connected and detached sessions
+void server_free_session(server *serv, session *sess)
+{
+    // Before the room session goes, as the entry counts towards its room
+    if (sess->interf.presence)
+        pres_remove(&serv->presence, sess->interf.presence);
+    // The key is the session's own string, so drop it first
+    if (sess->resume_token[0])
+        hm_remove(&serv->resume_tokens, sess->resume_token);
+
+    cleanup_session(sess);
+    pool_free(&session_pool, sess);
+}
+
 void server_close_session(server *serv, int sd)
 {
+    session *sess = serv->sessions[sd];
     close(sd);
-    cleanup_session(serv->sessions[sd]);
-    free(serv->sessions[sd]);
     serv->sessions[sd] = NULL;
-    serv->logged_in_usernames.data[sd] = NULL;
+    server_free_session(serv, sess);
+}
+
+// Instead of closing: the room session stays in its room, keeping the seat
+void server_detach_session(server *serv, int sd)
+{
+    session *sess = serv->sessions[sd];
+    close(sd);
+    serv->sessions[sd] = NULL;
+
+    sess->fd = -1;
+    sess->buf_used = 0;
+    sess->detached = true;
+    pres_set_state(sess->interf.presence, pst_away);
+    sess->detach_deadline = get_msec() + RESUME_GRACE_SEC*1000;
+    svec_push(&serv->detached, sess);
+}
+
+static bool session_can_be_detached(server *serv, session *sess)
+{
+    return sess->username && sess->resume_token[0] &&
+           sess->rs->room != serv->hub && !sess->interf.quit;
+}
+
+// Moves the connection at sd over to the detached session with the token
+void server_try_resume(server *serv, int sd)
+{
+    session *sess = serv->sessions[sd];
+    session *old = hm_get(&serv->resume_tokens, sess->interf.resume_req);
+    sess->interf.resume_req[0] = '\0';
+
+    if (!old || !old->detached) {
+        OUTBUF_POST(sess->rs, "Invalid or expired resume token\r\nInput your username: ");
+        return;
+    }
+
+    svec_swap_remove(&serv->detached, svec_find(&serv->detached, old));
+    old->detached = false;
+    pres_set_state(old->interf.presence, pst_online);
+    old->fd = sd;
+    serv->sessions[sd] = old;
+    server_free_session(serv, sess);
+
+    const char *msg = "\r\nWelcome back! Your seat has been kept\r\n";
+    outbuf_append(&old->interf, msg, strlen(msg));
+
+    const room_preset_t *preset = old->rs->room->preset;
+    if (preset->resume_f)
+        (*preset->resume_f)(old->rs);
+}
+
+// Returns the msec until the next deadline, -1 if no sessions are detached
+long server_drop_expired_sessions(server *serv)
+{
+    long now = get_msec();
+    long next = -1;
+    for (int i = 0; i < serv->detached.size; ) {
+        session *sess = svec_at(&serv->detached, i);
+        if (sess->detach_deadline <= now) {
+            svec_swap_remove(&serv->detached, i);
+            server_free_session(serv, sess);
+            continue;
+        }
+
+        long left = sess->detach_deadline - now;
+        if (next < 0 || left < next)
+            next = left;
+        i++;
+    }
+
+    return next;
 }
 
 void init_subsystems()
 {
     srand(time(NULL));
+    cq_init();
+    wp_init();
 }
 
 int main(int argc, char **argv) 
 {
     server serv;
-    long port;
+    long port, max_rooms = DEFAULT_MAX_ROOMS;
+
+    const char *admin_username = NULL;
     char *endptr;
 
-    ASSERTF(argc == 2, "Args: <port>\n");
+    ASSERTF(argc >= 2 && argc <= 4, "Args: <port> [max rooms] [admin username]\n");
 
     port = strtol(argv[1], &endptr, 10);
     ASSERTF(*argv[1] && !*endptr, "Invalid port number\n");
+    if (argc >= 3) {
+        max_rooms = strtol(argv[2], &endptr, 10);
+        ASSERTF(*argv[2] && !*endptr && max_rooms > 0 && max_rooms <= INT_MAX,
+                "Invalid max rooms number\n");
+    }
+    if (argc == 4)
+        admin_username = argv[3];
         
     init_subsystems();
-    server_init(&serv, port);
+    server_init(&serv, port, max_rooms, admin_username);
 
     for (;;) {
+        // Before the fd sets are built: freeing a seat and room timers may post
+        //  to sessions, and chat messages of the last iteration go out here
+        long timeout_ms = server_drop_expired_sessions(&serv);
+        long timer_ms = room_timers_run(get_msec());
+        if (timer_ms >= 0 && (timeout_ms < 0 || timer_ms < timeout_ms))
+            timeout_ms = timer_ms;
+        long chat_ms = chat_flush_pending(get_msec());
+        if (chat_ms >= 0 && (timeout_ms < 0 || chat_ms < timeout_ms))
+            timeout_ms = chat_ms;
+
         fd_set readfds, writefds;
         FD_ZERO(&readfds);
         FD_ZERO(&writefds);
         FD_SET(serv.ls, &readfds);
+        FD_SET(cq_fd(), &readfds);
 
-        int maxfd = serv.ls;
+        int maxfd = serv.ls > cq_fd() ? serv.ls : cq_fd();
         for (int i = 0; i < serv.sessions_size; i++) {
             session *sess = serv.sessions[i];
             if (sess) {
@@ -255,11 +439,16 @@ int main(int argc, char **argv)
             }
         }
 
-        int sr = select(maxfd+1, &readfds, &writefds, NULL, NULL);
+        struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+
+        int sr = select(maxfd+1, &readfds, &writefds, NULL, timeout_ms >= 0 ? &tv : NULL);
         ASSERT_ERR(sr >= 0);
 
         if (FD_ISSET(serv.ls, &readfds))
             server_accept_client(&serv);
+        // Results of background work (e.g. committed registrations)
+        if (FD_ISSET(cq_fd(), &readfds))
+            cq_dispatch();
         for (int i = 0; i < serv.sessions_size; i++) {
             session *sess = serv.sessions[i];
             if (sess) {
@@ -267,18 +456,29 @@ int main(int argc, char **argv)
                         // Try read incoming data, close if disconnected
                         (FD_ISSET(i, &readfds) && !session_do_read(sess)) ||
                         // Try write queued data, close if disconnected
-                        (FD_ISSET(i, &writefds) && !session_do_write(sess)) ||
-                        // If logic says "quit" and all data is sent, also close
-                        (sess->interf.quit && !sess->interf.out_buf)
-                   ) 
+                        (FD_ISSET(i, &writefds) && !session_do_write(sess))
+                   )
                 {
+                    // A dropped player keeps the seat for a while
+                    if (session_can_be_detached(&serv, sess))
+                        server_detach_session(&serv, i);
+                    else
+                        server_close_session(&serv, i);
+                    continue;
+                }
+                // If logic says "quit" and all data is sent, also close
+                if (sess->interf.quit && !sess->interf.out_buf) {
                     server_close_session(&serv, i);
                     continue;
-                }  
+                }
+
+                if (sess->interf.resume_req[0]) {
+                    server_try_resume(&serv, i);
+                    sess = serv.sessions[i];
+                }
 
                 if (sess->interf.need_to_register_username) {
-                    sess->username = sess->rs->username;
-                    serv.logged_in_usernames.data[i] = sess->rs->username;
+                    server_register_user(&serv, sess);
                     sess->interf.need_to_register_username = false;
                 } 
 
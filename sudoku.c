@@ -5,10 +5,14 @@
 #include "logic.h"
 #include "chat_funcs.h"
 #include "utils.h"
+#include "commands.h"
 #include <string.h>
 
 #define MAX_PLAYERS_PER_GAME 8
 
+// The actor passes automatically after this long
+#define TURN_TIMEOUT_SEC 60
+
 typedef struct sudoku_session_data_tag {
     player_state_t state;
 } sudoku_session_data_t;
@@ -22,6 +26,12 @@ typedef struct sudoku_room_data_tag {
     server_room_t *hub_ref;
 } sudoku_room_data_t;
 
+#define ROOM_DATA_PER_SLAB 4
+
+// One slab of session data fits a full room
+static mem_pool_t sess_data_pool = MEM_POOL_INITIALIZER(sudoku_session_data_t, MAX_PLAYERS_PER_GAME);
+static mem_pool_t room_data_pool = MEM_POOL_INITIALIZER(sudoku_room_data_t, ROOM_DATA_PER_SLAB);
+
 static const char tutorial_text[] = 
     "Welcome to the game of SUDOKU! "
     "Press ENTER to %s the game\r\n"
@@ -29,25 +39,24 @@ static const char tutorial_text[] =
     "   <quit>: quit the game, works at any moment\r\n"
     "   <chat>: switch to in-game chat, works only when the game is in progress\r\n"
     "   <game>: switch back from chat to game\r\n"
+    "   <history>: show the whole chat history, works only in chat\r\n"
+    "   </join *channel*>, </leave *channel*>, </channels>, <#*channel* *msg*>: chat channels, in chat\r\n"
+    "   </w *user* *msg*>: whisper to a user, works only in chat\r\n"
     "   <tutor>: show this message again\r\n"
     "   <L# d>: put digit d at col L row #\r\n"
     "   <rm L#>: remove digit at col L row #, if you can\r\n"
     "   <pass>: skip turn\r\n";
 
-void sudoku_init_subsystems()
-{
-    sgen_init();
-}
-
 static void reset_room(server_room_t *s_room);
 
 void sudoku_init_room(server_room_t *s_room, void *payload)
 {
-    s_room->sess_cap = MAX_PLAYERS_PER_GAME;
-    s_room->sess_refs = malloc(s_room->sess_cap * sizeof(*s_room->sess_refs));
-    s_room->data = malloc(sizeof(sudoku_room_data_t));
+    s_room->data = pool_alloc(&room_data_pool);
+    mem_charge(&s_room->mem, room_data_pool.elem_size);
 
     sudoku_room_data_t *r_data = s_room->data;
+    room_members_init(s_room, MAX_PLAYERS_PER_GAME, true);
+
     game_payload_t *payload_data = payload;
     r_data->hub_ref = payload_data->hub_ref;
 
@@ -56,13 +65,15 @@ void sudoku_init_room(server_room_t *s_room, void *payload)
 
 void sudoku_deinit_room(server_room_t *s_room)
 {
-    free(s_room->data);
-    free(s_room->sess_refs);
+    mem_uncharge(&s_room->mem, room_data_pool.elem_size);
+    pool_free(&room_data_pool, s_room->data);
+    room_members_deinit(s_room);
 }
 
 void sudoku_init_room_session(room_session_t *r_sess)
 {
-    r_sess->data = malloc(sizeof(sudoku_session_data_t));
+    r_sess->data = pool_alloc(&sess_data_pool);
+    mem_charge(&r_sess->room->mem, sess_data_pool.elem_size);
 
     sudoku_session_data_t *rs_data = r_sess->data;
     server_room_t *s_room = r_sess->room;
@@ -74,16 +85,16 @@ void sudoku_init_room_session(room_session_t *r_sess)
         OUTBUF_POSTF(r_sess, "The server is full (%d/%d)!\r\n",
                      s_room->sess_cap, s_room->sess_cap);
         
-        r_sess->interf->next_room = r_data->hub_ref;
+        set_next_room(r_sess->interf, r_data->hub_ref);
         return;
     } else if (r_data->state == gs_game_end) {
         OUTBUF_POST(r_sess, "The game has ended, wait for all players to exit and try again!\r\n");
-        r_sess->interf->next_room = r_data->hub_ref;
+        set_next_room(r_sess->interf, r_data->hub_ref);
         return;
     }
 
     OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
-    s_room->sess_refs[s_room->sess_cnt++] = r_sess;
+    room_add_member(s_room, r_sess);
 }
 
 static void send_updates_to_all_players(server_room_t *s_room);
@@ -94,20 +105,9 @@ void sudoku_deinit_room_session(room_session_t *r_sess)
     server_room_t *s_room = r_sess->room;
     sudoku_room_data_t *r_data = s_room->data;
 
-    bool offset = false;
-    for (int i = 0; i < s_room->sess_cnt; i++) {
-        if (s_room->sess_refs[i] == r_sess) {
-            offset = true;
-
-            if (r_data->actor_index > i)
-                r_data->actor_index--;
-        } else if (offset) {
-            s_room->sess_refs[i-1] = s_room->sess_refs[i];
-            s_room->sess_refs[i] = NULL;
-        }
-    }
-    if (offset) 
-        s_room->sess_cnt--;
+    int idx = room_remove_member(s_room, r_sess);
+    if (idx >= 0 && r_data->actor_index > idx)
+        r_data->actor_index--;
 
     // If last player quit, reset server
     if (s_room->sess_cnt == 0)
@@ -115,7 +115,8 @@ void sudoku_deinit_room_session(room_session_t *r_sess)
     else if (r_data->state != gs_game_end)
         send_updates_to_all_players(s_room);
 
-    free(rs_data);
+    mem_uncharge(&s_room->mem, sess_data_pool.elem_size);
+    pool_free(&sess_data_pool, rs_data);
     r_sess->data = NULL;
 }
 
@@ -125,14 +126,130 @@ static void respond_to_invalid_command(room_session_t *r_sess);
 static void send_updates_to_player(server_room_t *s_room, int i);
 static int get_actor_index(room_session_t *r_sess, server_room_t *s_room);
 
+// Commands other than <quit> are only taken mid-game, out of the lobby
+static inline bool takes_commands(room_session_t *r_sess)
+{
+    sudoku_session_data_t *rs_data = r_sess->data;
+    sudoku_room_data_t *r_data = r_sess->room->data;
+    return r_data->state != gs_game_end && r_data->state != gs_awaiting_players &&
+           rs_data->state != ps_lobby;
+}
+
+// Moves, outside the chat and the tutorial, on your turn
+static inline bool takes_moves(room_session_t *r_sess)
+{
+    sudoku_session_data_t *rs_data = r_sess->data;
+    return takes_commands(r_sess) && !r_sess->is_in_chat && !r_sess->is_in_tutorial &&
+           rs_data->state == ps_acting;
+}
+
+// L#, as the column letter and the row digit
+static bool parse_cell(cmd_tokenizer_t *tok, int *row, int *col)
+{
+    return tok_letter(tok, col) && *col < BOARD_SIZE &&
+           tok_digit(tok, row) && *row < BOARD_SIZE;
+}
+
+static bool cmd_quit(room_session_t *r_sess, const char *args)
+{
+    sudoku_room_data_t *r_data = r_sess->room->data;
+    set_next_room(r_sess->interf, r_data->hub_ref);
+    return true;
+}
+
+static bool cmd_game(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || !r_sess->is_in_chat)
+        return false;
+    r_sess->is_in_chat = false;
+    send_updates_to_player(r_sess->room, get_actor_index(r_sess, r_sess->room));
+    return true;
+}
+
+static bool cmd_history(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || !r_sess->is_in_chat)
+        return false;
+    chat_send_history(r_sess, "In-game chat\r\n\r\n");
+    return true;
+}
+
+static bool cmd_chat(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || r_sess->is_in_chat)
+        return false;
+    r_sess->is_in_chat = true;
+    chat_send_updates(r_sess, "In-game chat\r\n\r\n");
+    return true;
+}
+
+static bool cmd_tutor(room_session_t *r_sess, const char *args)
+{
+    if (!takes_commands(r_sess) || r_sess->is_in_chat || r_sess->is_in_tutorial)
+        return false;
+    r_sess->is_in_tutorial = true;
+    OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
+    return true;
+}
+
+static bool cmd_pass(room_session_t *r_sess, const char *args)
+{
+    if (!takes_moves(r_sess))
+        return false;
+    advance_turns(r_sess->room);
+    return true;
+}
+
+static bool cmd_rm(room_session_t *r_sess, const char *args)
+{
+    if (!takes_moves(r_sess))
+        return false;
+
+    sudoku_room_data_t *r_data = r_sess->room->data;
+    int row, col;
+    cmd_tokenizer_t tok;
+    tok_init(&tok, args);
+    if (!parse_cell(&tok, &row, &col) || !tok_at_end(&tok)) {
+        respond_to_invalid_command(r_sess);
+        return true;
+    }
+
+    if (board_try_remove_number(&r_data->board, row, col))
+        advance_turns(r_sess->room);
+    else
+        OUTBUF_POST(r_sess, "This number can not be removed!\r\nYour turn: > ");
+    return true;
+}
+
+static const command_t command_list[] = {
+    { "quit",       ca_none,        &cmd_quit },
+    { "game",       ca_none,        &cmd_game },
+    { "history",    ca_none,        &cmd_history },
+    { "chat",       ca_none,        &cmd_chat },
+    { "tutor",      ca_none,        &cmd_tutor },
+    { "pass",       ca_none,        &cmd_pass },
+    { "rm",         ca_required,    &cmd_rm }
+};
+
+static command_table_t commands;
+
+void sudoku_init_subsystems()
+{
+    sgen_init();
+    cmdt_init(&commands, command_list, sizeof(command_list)/sizeof(*command_list));
+}
+
 void sudoku_process_line(room_session_t *r_sess, const char *line)
 {
     sudoku_session_data_t *rs_data = r_sess->data;
     server_room_t *s_room = r_sess->room;
     sudoku_room_data_t *r_data = s_room->data;
 
-    if (streq(line, "quit") || r_data->state == gs_game_end) {
-        r_sess->interf->next_room = r_data->hub_ref;
+    if (cmdt_dispatch(&commands, r_sess, line))
+        return;
+
+    if (r_data->state == gs_game_end) {
+        set_next_room(r_sess->interf, r_data->hub_ref);
         return;
     }
 
@@ -151,31 +268,17 @@ void sudoku_process_line(room_session_t *r_sess, const char *line)
     }
 
     if (r_sess->is_in_chat) {
-        if (streq(line, "game")) {
-            r_sess->is_in_chat = false;
-            send_updates_to_player(s_room, get_actor_index(r_sess, s_room));
-        } else if (strlen(line) > 0) {
-            if (!chat_try_post_message(s_room->chat, s_room, r_sess, line))
-                OUTBUF_POST(r_sess, "The message is too long!\r\n");
+        if (strlen(line) > 0 && !chat_try_process_command(r_sess, line)) {
+            chat_post_result_t res = chat_try_post_message(s_room->chat, s_room, r_sess, line);
+            if (res != cpr_ok)
+                OUTBUF_POST(r_sess, chat_post_result_text(res));
         }
         return;
-    } else if (rs_data->state != ps_lobby && streq(line, "chat")) {
-        r_sess->is_in_chat = true;
-        chat_send_updates(s_room->chat, r_sess, "In-game chat\r\n\r\n");
-        return;
     }
 
     if (r_sess->is_in_tutorial) {
         r_sess->is_in_tutorial = false;
-        if (r_sess->is_in_chat)
-            chat_send_updates(s_room->chat, r_sess, "In-game chat\r\n\r\n");
-        else
-            send_updates_to_player(s_room, get_actor_index(r_sess, s_room));
-        
-        return;
-    } else if (streq(line, "tutor")) {
-        r_sess->is_in_tutorial = true;
-        OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
+        send_updates_to_player(s_room, get_actor_index(r_sess, s_room));
         return;
     }
 
@@ -184,54 +287,23 @@ void sudoku_process_line(room_session_t *r_sess, const char *line)
         return;
     }
 
-    if (streq(line, "pass")) {
-        advance_turns(s_room);
+    // L# d
+    int row, col, number;
+    cmd_tokenizer_t tok;
+    tok_init(&tok, line);
+    if (
+            !parse_cell(&tok, &row, &col) || !tok_char(&tok, ' ') ||
+            !tok_digit(&tok, &number) || !tok_at_end(&tok) || number < 1
+       )
+    {
+        respond_to_invalid_command(r_sess);
         return;
     }
 
-    int col, row;
-    if (strlen(line) == 4) {
-        int number;
-        if (
-                sscanf(line, "%lc%d %d", &col, &row, &number) != 3 ||
-                (
-                 (col < 'A' || col > 'A' + BOARD_SIZE - 1) &&
-                 (col < 'a' || col > 'a' + BOARD_SIZE - 1)
-                ) ||
-                row < 0 || row > BOARD_SIZE-1 ||
-                number < 1 || number > BOARD_SIZE
-           ) 
-        {
-            respond_to_invalid_command(r_sess);
-            return;
-        }
-
-        col = col >= 'a' ? col-'a' : col-'A';
-        if (board_try_put_number(&r_data->board, number, row, col))
-            advance_turns(s_room);
-        else
-            OUTBUF_POST(r_sess, "Can't place this number here! Try again:)\r\nYour turn: > ");
-    } else if (strncmp(line, "rm ", 3) == 0) {
-        if (
-                sscanf(line+3, "%lc%d", &col, &row) != 2 ||
-                (
-                 (col < 'A' || col > 'A' + BOARD_SIZE - 1) &&
-                 (col < 'a' || col > 'a' + BOARD_SIZE - 1)
-                ) ||
-                row < 0 || row > BOARD_SIZE-1
-           )
-        {
-            respond_to_invalid_command(r_sess);
-            return;
-        }
-
-        col = col >= 'a' ? col-'a' : col-'A';
-        if (board_try_remove_number(&r_data->board, row, col))
-            advance_turns(s_room);
-        else
-            OUTBUF_POST(r_sess, "This number can not be removed!\r\nYour turn: > ");
-    } else
-        respond_to_invalid_command(r_sess);
+    if (board_try_put_number(&r_data->board, number, row, col))
+        advance_turns(s_room);
+    else
+        OUTBUF_POST(r_sess, "Can't place this number here! Try again:)\r\nYour turn: > ");
 }
 
 bool sudoku_room_is_available(server_room_t *s_room)
@@ -242,12 +314,10 @@ bool sudoku_room_is_available(server_room_t *s_room)
 
 static void reset_room(server_room_t *s_room)
 {
-    for (int i = 0; i < s_room->sess_cap; i++)
-        s_room->sess_refs[i] = NULL;
-
-    s_room->sess_cnt = 0;
+    ASSERT(s_room->sess_cnt == 0);
 
     sudoku_room_data_t *r_data = s_room->data;
+    room_cancel_timer(s_room);
     r_data->state = gs_awaiting_players;
     r_data->actor_index = 0;
 }
@@ -256,9 +326,11 @@ static void start_game(server_room_t *s_room)
 {
     sudoku_room_data_t *r_data = s_room->data;
     r_data->state = gs_in_progress;
+    room_state_changed(s_room);
     // From a cache of asynchronously generated boards
     sgen_get_new_board(&r_data->board);
 
+    room_set_timer(s_room, TURN_TIMEOUT_SEC * 1000);
     send_updates_to_all_players(s_room);
 }
 
@@ -270,6 +342,8 @@ static void advance_turns(server_room_t *s_room)
 
     if (board_is_solved(&r_data->board)) {
         r_data->state = gs_game_end;
+        room_cancel_timer(s_room);
+        room_state_changed(s_room);
 
         for (int i = 0; i < s_room->sess_cnt; i++) {
             room_session_t *r_sess = s_room->sess_refs[i]; 
@@ -288,10 +362,45 @@ static void advance_turns(server_room_t *s_room)
         } while (actor_rs->state == ps_lobby);
 
         actor_rs->state = ps_acting;
+        room_set_timer(s_room, TURN_TIMEOUT_SEC * 1000);
         send_updates_to_all_players(s_room);
     }
 }
 
+void sudoku_turn_timed_out(server_room_t *s_room)
+{
+    sudoku_room_data_t *r_data = s_room->data;
+    if (r_data->state != gs_in_progress || s_room->sess_cnt == 0)
+        return;
+
+    advance_turns(s_room);
+
+    const char *msg = "Time is up, the turn has been passed\r\n";
+    for (int i = 0; i < s_room->sess_cnt; i++) {
+        room_session_t *r_sess = s_room->sess_refs[i];
+        sudoku_session_data_t *rs_data = r_sess->data;
+        if (!r_sess->is_in_chat && rs_data->state != ps_lobby)
+            outbuf_append(r_sess->interf, msg, strlen(msg));
+    }
+}
+
+// Puts back the screen the player was on when the connection dropped
+void sudoku_resume_room_session(room_session_t *r_sess)
+{
+    sudoku_session_data_t *rs_data = r_sess->data;
+    server_room_t *s_room = r_sess->room;
+    sudoku_room_data_t *r_data = s_room->data;
+
+    if (r_data->state == gs_game_end)
+        OUTBUF_POST(r_sess, "The game has ended. Press ENTER to exit\r\n");
+    else if (rs_data->state == ps_lobby || r_sess->is_in_tutorial)
+        OUTBUF_POSTF(r_sess, "%s%s", clrscr, tutorial_text);
+    else if (r_sess->is_in_chat)
+        chat_send_history(r_sess, "In-game chat\r\n\r\n");
+    else
+        send_updates_to_player(s_room, get_actor_index(r_sess, s_room));
+}
+
 static void respond_to_invalid_command(room_session_t *r_sess)
 {
     sudoku_session_data_t *rs_data = r_sess->data;
@@ -393,11 +502,8 @@ static void sb_add_line(string_builder_t *sb, sudoku_board_t *board, int y)
 
 static int get_actor_index(room_session_t *r_sess, server_room_t *s_room)
 {
-    for (int i = 0; i < s_room->sess_cnt; i++) {
-        if (r_sess == s_room->sess_refs[i])
-            return i;
-    }
-    return -1;
+    ASSERT(r_sess->room == s_room);
+    return r_sess->member_idx;
 }
 
 static void log_game_results(server_room_t *s_room)
@@ -12,5 +12,7 @@ void sudoku_init_room_session(room_session_t *r_sess);
 void sudoku_deinit_room_session(room_session_t *r_sess);
 void sudoku_process_line(room_session_t *r_sess, const char *line);
 bool sudoku_room_is_available(server_room_t *s_room);
+void sudoku_turn_timed_out(server_room_t *s_room);
+void sudoku_resume_room_session(room_session_t *r_sess);
 
 #endif
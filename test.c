@@ -1,8 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <limits.h>
 #include "sudoku_board.h"
 #include "sudoku_generator.h"
+#include "commands.h"
+#include "logic.h"
+
+static int failures = 0;
+
+#define CHECK(_e) if (!(_e)) { printf("FAILED at %s:%d: %s\n", __FILE__, __LINE__, #_e); failures++; }
 
 long get_nsec()
 {
@@ -36,8 +44,243 @@ bool sudoku_is_correct(sudoku_board_t *board)
     return true;
 }
 
+static bool dummy_cmd(room_session_t *r_sess, const char *args)
+{
+    return true;
+}
+
+static const command_t test_commands[] = {
+    { "quit",   ca_none,        &dummy_cmd },
+    { "pass",   ca_none,        &dummy_cmd },
+    { "play",   ca_required,    &dummy_cmd },
+    { "listr",  ca_optional,    &dummy_cmd },
+    { "li",     ca_none,        &dummy_cmd }
+};
+
+// NULL for no command, otherwise name and args must match
+static bool finds(command_table_t *t, const char *line, const char *name, const char *args)
+{
+    const char *found_args = NULL;
+    const command_t *cmd = cmdt_find(t, line, &found_args);
+    if (!cmd || !name)
+        return !cmd && !name;
+    return strcmp(cmd->name, name) == 0 && strcmp(found_args, args) == 0;
+}
+
+static void test_command_lookup()
+{
+    command_table_t t;
+    cmdt_init(&t, test_commands, sizeof(test_commands)/sizeof(*test_commands));
+
+    CHECK(finds(&t, "quit", "quit", ""));
+    CHECK(finds(&t, "quit now", NULL, NULL));       // ca_none takes no args
+    CHECK(finds(&t, "pass", "pass", ""));
+
+    CHECK(finds(&t, "play", NULL, NULL));           // ca_required needs the space
+    CHECK(finds(&t, "play ", "play", ""));
+    CHECK(finds(&t, "play fool", "play", "fool"));
+    CHECK(finds(&t, "play  fool", "play", " fool"));
+
+    CHECK(finds(&t, "listr", "listr", ""));         // ca_optional either way
+    CHECK(finds(&t, "listr open page 2", "listr", "open page 2"));
+    CHECK(finds(&t, "li", "li", ""));               // A command that is a prefix of another
+
+    // Prefixes, extensions, case and bytes not in any name
+    CHECK(finds(&t, "", NULL, NULL));
+    CHECK(finds(&t, "q", NULL, NULL));
+    CHECK(finds(&t, "pa", NULL, NULL));
+    CHECK(finds(&t, "lis", NULL, NULL));
+    CHECK(finds(&t, "quits", NULL, NULL));
+    CHECK(finds(&t, "QUIT", NULL, NULL));
+    CHECK(finds(&t, "qu\xffit", NULL, NULL));
+    CHECK(finds(&t, "\x01", NULL, NULL));
+    CHECK(finds(&t, " quit", NULL, NULL));
+}
+
+static void test_tokenizer()
+{
+    cmd_tokenizer_t tok;
+    int val;
+
+    tok_init(&tok, "8");
+    CHECK(tok_uint(&tok, 8, &val) && val == 8 && tok_at_end(&tok));
+    tok_init(&tok, "9");
+    CHECK(!tok_uint(&tok, 8, &val));
+    tok_init(&tok, "");
+    CHECK(!tok_uint(&tok, 8, &val));
+    tok_init(&tok, "-1");
+    CHECK(!tok_uint(&tok, 8, &val));
+    tok_init(&tok, "007");
+    CHECK(tok_uint(&tok, 8, &val) && val == 7);
+    tok_init(&tok, "12x");
+    CHECK(tok_uint(&tok, 100, &val) && val == 12 && !tok_at_end(&tok));
+
+    // Right at the int limit and past it, no overflow on the way
+    tok_init(&tok, "2147483647");
+    CHECK(tok_uint(&tok, INT_MAX, &val) && val == INT_MAX);
+    tok_init(&tok, "2147483648");
+    CHECK(!tok_uint(&tok, INT_MAX, &val));
+    tok_init(&tok, "107374184000000000000");
+    CHECK(!tok_uint(&tok, INT_MAX, &val));
+
+    tok_init(&tok, "a");
+    CHECK(tok_letter(&tok, &val) && val == 0);
+    tok_init(&tok, "Z");
+    CHECK(tok_letter(&tok, &val) && val == 25);
+    tok_init(&tok, "@");
+    CHECK(!tok_letter(&tok, &val));             // Right before 'A'
+    tok_init(&tok, "[");
+    CHECK(!tok_letter(&tok, &val));             // Right after 'Z'
+    tok_init(&tok, "`");
+    CHECK(!tok_letter(&tok, &val));
+    tok_init(&tok, "{");
+    CHECK(!tok_letter(&tok, &val));
+    tok_init(&tok, "1");
+    CHECK(!tok_letter(&tok, &val));
+
+    tok_init(&tok, "5");
+    CHECK(tok_digit(&tok, &val) && val == 5 && tok_at_end(&tok));
+    tok_init(&tok, "a");
+    CHECK(!tok_digit(&tok, &val));
+
+    // Sudoku moves, L# d: one digit for the row, one space
+    int col, row;
+    tok_init(&tok, "b3 5");
+    CHECK(tok_letter(&tok, &col) && tok_digit(&tok, &row) && tok_char(&tok, ' ') &&
+          tok_digit(&tok, &val) && tok_at_end(&tok) && col == 1 && row == 3 && val == 5);
+    tok_init(&tok, "A01 5");
+    CHECK(!(tok_letter(&tok, &col) && tok_digit(&tok, &row) && tok_char(&tok, ' ')));
+    tok_init(&tok, "A1   5");
+    CHECK(!(tok_letter(&tok, &col) && tok_digit(&tok, &row) && tok_char(&tok, ' ') &&
+            tok_digit(&tok, &val)));
+
+    char buf[8];
+    tok_init(&tok, "  open   page 2 ");
+    CHECK(tok_word(&tok, buf, sizeof(buf)) && strcmp(buf, "open") == 0);
+    CHECK(tok_word(&tok, buf, sizeof(buf)) && strcmp(buf, "page") == 0);
+    CHECK(tok_spaces(&tok) && tok_uint(&tok, INT_MAX, &val) && val == 2);
+    CHECK(tok_at_end(&tok) && !tok_word(&tok, buf, sizeof(buf)));
+    tok_init(&tok, "toolongword");
+    CHECK(!tok_word(&tok, buf, sizeof(buf)));
+    tok_init(&tok, "x");
+    CHECK(!tok_spaces(&tok));
+}
+
+#define TIMER_ROOMS      8
+#define RANDOM_ROOMS     200
+
+static server_room_t *fired[RANDOM_ROOMS*2];
+static int fired_cnt = 0;
+static int rearm_left = 0;
+
+static void record_timer(server_room_t *s_room)
+{
+    fired[fired_cnt++] = s_room;
+    if (rearm_left > 0) {
+        rearm_left--;
+        room_set_timer(s_room, 100);
+    }
+}
+
+static const room_preset_t timer_preset = { .name = "timer", .timer_f = &record_timer };
+
+static void init_timer_rooms(server_room_t *rooms, int cnt)
+{
+    memset(rooms, 0, cnt * sizeof(*rooms));
+    for (int i = 0; i < cnt; i++) {
+        rooms[i].preset = &timer_preset;
+        rooms[i].timer_idx = -1;
+    }
+}
+
+static void test_room_timers()
+{
+    server_room_t rooms[TIMER_ROOMS];
+    init_timer_rooms(rooms, TIMER_ROOMS);
+
+    // Delays are far enough apart for the clock not to reorder them
+    static const long delays[TIMER_ROOMS] = { 50, 10, 70, 30, 20, 60, 40, 0 };
+    long base = get_msec();
+    for (int i = 0; i < TIMER_ROOMS; i++)
+        room_set_timer(&rooms[i], delays[i]);
+
+    room_cancel_timer(&rooms[3]);
+    room_cancel_timer(&rooms[3]);   // No-op when not set
+    room_set_timer(&rooms[2], 5);   // Moves up
+    room_set_timer(&rooms[1], 65);  // Moves down
+    CHECK(rooms[3].timer_idx == -1);
+
+    // Only the due ones run, and the next deadline is returned
+    fired_cnt = 0;
+    long left = room_timers_run(base + 7);
+    CHECK(fired_cnt <= 2);
+    CHECK(left > 0 && left <= 20);
+
+    left = room_timers_run(base + 1000);
+    CHECK(left == -1);
+    static const int order[] = { 7, 2, 4, 6, 0, 5, 1 };
+    CHECK(fired_cnt == sizeof(order)/sizeof(*order));
+    for (int i = 0; i < fired_cnt && i < sizeof(order)/sizeof(*order); i++)
+        CHECK(fired[i] == &rooms[order[i]]);
+    for (int i = 0; i < TIMER_ROOMS; i++)
+        CHECK(rooms[i].timer_idx == -1);
+
+    // A callback may set its room's timer again, it runs on a later call
+    fired_cnt = 0;
+    rearm_left = 1;
+    room_set_timer(&rooms[0], 0);
+    room_timers_run(get_msec());
+    CHECK(fired_cnt == 1 && rooms[0].timer_idx >= 0);
+    room_timers_run(get_msec() + 1000);
+    CHECK(fired_cnt == 2 && rooms[0].timer_idx == -1);
+
+    // Random sets, resets and cancels: the rest run in deadline order
+    static server_room_t many[RANDOM_ROOMS];
+    init_timer_rooms(many, RANDOM_ROOMS);
+    srand(1);
+    for (int i = 0; i < RANDOM_ROOMS*3; i++) {
+        server_room_t *room = &many[rand() % RANDOM_ROOMS];
+        if (rand() % 4 == 0)
+            room_cancel_timer(room);
+        else
+            room_set_timer(room, rand() % 100000);
+    }
+    int armed = 0;
+    for (int i = 0; i < RANDOM_ROOMS; i++)
+        armed += many[i].timer_idx >= 0;
+
+    fired_cnt = 0;
+    room_timers_run(get_msec() + 1000000);
+    CHECK(fired_cnt == armed);
+    for (int i = 1; i < fired_cnt; i++)
+        CHECK(fired[i-1]->timer_due <= fired[i]->timer_due);
+}
+
+static void test_svec_remove()
+{
+    static int items[12];
+    small_vec_t v;
+    svec_init(&v);
+    for (int i = 0; i < 12; i++)    // Past the inline buffer
+        svec_push(&v, &items[i]);
+
+    svec_remove(&v, 3);
+    svec_remove(&v, 0);
+    svec_remove(&v, v.size-1);
+    CHECK(v.size == 9);
+    static const int order[] = { 1, 2, 4, 5, 6, 7, 8, 9, 10 };
+    for (int i = 0; i < v.size; i++)
+        CHECK(svec_at(&v, i) == &items[order[i]]);
+    svec_deinit(&v);
+}
+
 int main()
 {
+    test_svec_remove();
+    test_command_lookup();
+    test_tokenizer();
+    test_room_timers();
+
     /*
     sudoku_board_t board;
     srand(time(NULL));
@@ -99,5 +342,10 @@ int main()
     }
     */
 
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
     return 0;
 }
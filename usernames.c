@@ -0,0 +1,69 @@
+/* TextGameServer/usernames.c */
+#include "usernames.h"
+#include "utils.h"
+#include "mem_stats.h"
+#include <stddef.h>
+#include <string.h>
+
+#define INIT_NAMES_TABLE_SIZE 64
+
+typedef struct interned_name_tag {
+    int refcnt;
+    char str[];
+} interned_name_t;
+
+static hash_map_t names_table = { 0 };
+
+static inline interned_name_t *name_from_handle(const char *handle)
+{
+    return (interned_name_t *) (handle - offsetof(interned_name_t, str));
+}
+
+const char *uname_intern(const char *name)
+{
+    if (!names_table.entries)
+        hm_init(&names_table, INIT_NAMES_TABLE_SIZE);
+
+    interned_name_t *in = hm_get(&names_table, name);
+    if (in) {
+        in->refcnt++;
+        return in->str;
+    }
+
+    size_t len = strlen(name);
+    in = MEM_ALLOC(mt_names, NULL, sizeof(*in) + len+1);
+    in->refcnt = 1;
+    memcpy(in->str, name, len+1);
+    hm_put(&names_table, in->str, in);
+
+    return in->str;
+}
+
+const char *uname_find(const char *name)
+{
+    if (!names_table.entries)
+        return NULL;
+
+    interned_name_t *in = hm_get(&names_table, name);
+    return in ? in->str : NULL;
+}
+
+const char *uname_retain(const char *handle)
+{
+    if (handle)
+        name_from_handle(handle)->refcnt++;
+    return handle;
+}
+
+void uname_release(const char *handle)
+{
+    if (!handle)
+        return;
+
+    interned_name_t *in = name_from_handle(handle);
+    ASSERT(in->refcnt > 0);
+    if (--in->refcnt == 0) {
+        hm_remove(&names_table, in->str);
+        mem_free(in);
+    }
+}
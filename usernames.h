@@ -0,0 +1,20 @@
+/* TextGameServer/usernames.h */
+#ifndef USERNAMES_SENTRY
+#define USERNAMES_SENTRY
+
+#include "defs.h"
+
+// Username intern table. Every distinct name exists once as a refcounted
+//  handle (a const char * to the interned string), so handles can be
+//  compared by pointer and stored without copying. Every uname_intern and
+//  uname_retain must be paired with a uname_release.
+
+const char *uname_intern(const char *name);
+// Returns the existing handle for name (without taking a ref) or NULL
+const char *uname_find(const char *name);
+const char *uname_retain(const char *handle);
+void uname_release(const char *handle);
+
+static inline bool uname_eq(const char *h1, const char *h2) { return h1 == h2; }
+
+#endif
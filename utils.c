@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h> 
+#include <time.h>
 
 linked_list_t *ll_create()
 {
@@ -93,6 +94,313 @@ bool ll_remove_at(linked_list_t *list, int idx)
     return ll_remove(list, node);
 }
 
+void svec_init(small_vec_t *v)
+{
+    v->data = v->inline_buf;
+    v->size = 0;
+    v->cap = SVEC_INLINE_CAP;
+}
+
+void svec_deinit(small_vec_t *v)
+{
+    if (v->data != v->inline_buf)
+        free(v->data);
+    svec_init(v);
+}
+
+void svec_push(small_vec_t *v, void *elem)
+{
+    if (v->size >= v->cap) {
+        int new_cap = v->cap * 2;
+        if (v->data == v->inline_buf) {
+            v->data = malloc(new_cap * sizeof(*v->data));
+            memcpy(v->data, v->inline_buf, v->size * sizeof(*v->data));
+        } else
+            v->data = realloc(v->data, new_cap * sizeof(*v->data));
+        v->cap = new_cap;
+    }
+
+    v->data[v->size++] = elem;
+}
+
+int svec_find(small_vec_t *v, void *query)
+{
+    for (int i = 0; i < v->size; i++) {
+        if (v->data[i] == query)
+            return i;
+    }
+    return -1;
+}
+
+void svec_remove(small_vec_t *v, int idx)
+{
+    ASSERT(idx >= 0 && idx < v->size);
+    v->size--;
+    memmove(&v->data[idx], &v->data[idx+1], (v->size - idx) * sizeof(*v->data));
+}
+
+void svec_swap_remove(small_vec_t *v, int idx)
+{
+    ASSERT(idx >= 0 && idx < v->size);
+    v->data[idx] = v->data[--v->size];
+}
+
+void rb_init(ring_buf_t *rb, int init_cap)
+{
+    int cap = 1;
+    while (cap < init_cap)
+        cap *= 2;
+
+    rb->data = malloc(cap * sizeof(*rb->data));
+    rb->head = 0;
+    rb->size = 0;
+    rb->cap = cap;
+}
+
+void rb_deinit(ring_buf_t *rb)
+{
+    free(rb->data);
+    rb->data = NULL;
+    rb->size = rb->cap = 0;
+}
+
+void rb_push_back(ring_buf_t *rb, void *elem)
+{
+    if (rb->size >= rb->cap) {
+        // Unroll into a bigger buffer so that head is at 0 again
+        void **new_data = malloc(2 * rb->cap * sizeof(*new_data));
+        for (int i = 0; i < rb->size; i++)
+            new_data[i] = rb_at(rb, i);
+        free(rb->data);
+        rb->data = new_data;
+        rb->head = 0;
+        rb->cap *= 2;
+    }
+
+    rb->data[(rb->head + rb->size) & (rb->cap-1)] = elem;
+    rb->size++;
+}
+
+void *rb_pop_front(ring_buf_t *rb)
+{
+    if (rb->size == 0)
+        return NULL;
+
+    void *elem = rb->data[rb->head];
+    rb->head = (rb->head + 1) & (rb->cap-1);
+    rb->size--;
+    return elem;
+}
+
+void rb_swap_remove(ring_buf_t *rb, int idx)
+{
+    ASSERT(idx >= 0 && idx < rb->size);
+    int last = (rb->head + rb->size - 1) & (rb->cap-1);
+    rb->data[(rb->head + idx) & (rb->cap-1)] = rb->data[last];
+    rb->size--;
+}
+
+// FNV-1a
+unsigned int hash_str(const char *s)
+{
+    unsigned int h = 2166136261u;
+    for (; *s; s++) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const char hm_tombstone_key[] = "";
+#define HM_TOMBSTONE hm_tombstone_key
+
+void hm_init(hash_map_t *hm, int init_cap)
+{
+    int cap = 8;
+    while (cap < init_cap)
+        cap *= 2;
+
+    hm->entries = calloc(cap, sizeof(*hm->entries));
+    hm->size = 0;
+    hm->tombstones = 0;
+    hm->cap = cap;
+}
+
+void hm_deinit(hash_map_t *hm)
+{
+    free(hm->entries);
+    hm->entries = NULL;
+    hm->size = hm->tombstones = hm->cap = 0;
+}
+
+static hash_map_entry_t *hm_probe(hash_map_t *hm, const char *key, unsigned int hash)
+{
+    int mask = hm->cap-1;
+    for (int i = hash & mask;; i = (i+1) & mask) {
+        hash_map_entry_t *e = &hm->entries[i];
+        if (!e->key)
+            return NULL;
+        if (
+                e->key != HM_TOMBSTONE && e->hash == hash &&
+                (e->key == key || streq(e->key, key))
+           )
+        {
+            return e;
+        }
+    }
+}
+
+hash_map_entry_t *hm_find(hash_map_t *hm, const char *key)
+{
+    return hm_probe(hm, key, hash_str(key));
+}
+
+void *hm_get(hash_map_t *hm, const char *key)
+{
+    hash_map_entry_t *e = hm_find(hm, key);
+    return e ? e->val : NULL;
+}
+
+static void hm_insert_new(hash_map_t *hm, const char *key, void *val, unsigned int hash)
+{
+    int mask = hm->cap-1;
+    int i = hash & mask;
+    while (hm->entries[i].key && hm->entries[i].key != HM_TOMBSTONE)
+        i = (i+1) & mask;
+
+    if (hm->entries[i].key == HM_TOMBSTONE)
+        hm->tombstones--;
+    hm->entries[i].key = key;
+    hm->entries[i].val = val;
+    hm->entries[i].hash = hash;
+    hm->size++;
+}
+
+static void hm_rehash(hash_map_t *hm, int new_cap)
+{
+    hash_map_entry_t *old = hm->entries;
+    int old_cap = hm->cap;
+
+    hm->entries = calloc(new_cap, sizeof(*hm->entries));
+    hm->cap = new_cap;
+    hm->size = 0;
+    hm->tombstones = 0;
+
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i].key && old[i].key != HM_TOMBSTONE)
+            hm_insert_new(hm, old[i].key, old[i].val, old[i].hash);
+    }
+    free(old);
+}
+
+void *hm_put(hash_map_t *hm, const char *key, void *val)
+{
+    unsigned int hash = hash_str(key);
+    hash_map_entry_t *e = hm_probe(hm, key, hash);
+    if (e) {
+        void *prev = e->val;
+        e->key = key;
+        e->val = val;
+        return prev;
+    }
+
+    // Keep load (with tombstones) under 3/4
+    if ((hm->size + hm->tombstones + 1) * 4 > hm->cap * 3)
+        hm_rehash(hm, (hm->size+1) * 2 > hm->cap ? hm->cap * 2 : hm->cap);
+
+    hm_insert_new(hm, key, val, hash);
+    return NULL;
+}
+
+void *hm_remove(hash_map_t *hm, const char *key)
+{
+    hash_map_entry_t *e = hm_find(hm, key);
+    if (!e)
+        return NULL;
+
+    void *val = e->val;
+    e->key = HM_TOMBSTONE;
+    e->val = NULL;
+    hm->size--;
+    hm->tombstones++;
+    return val;
+}
+
+int hm_next(hash_map_t *hm, int idx)
+{
+    for (idx++; idx < hm->cap; idx++) {
+        const char *key = hm->entries[idx].key;
+        if (key && key != HM_TOMBSTONE)
+            return idx;
+    }
+    return -1;
+}
+
+// Free elements store the next free element pointer in their first bytes
+typedef union pool_elem_tag {
+    union pool_elem_tag *next;
+    max_align_t align;
+} pool_elem_t;
+
+static mem_pool_t *pool_list = NULL;
+
+mem_pool_t *pool_list_head()
+{
+    return pool_list;
+}
+
+size_t pool_elem_size(mem_pool_t *p)
+{
+    size_t al = sizeof(pool_elem_t);
+    return ((MAX(p->elem_size, sizeof(pool_elem_t)) + al - 1) / al) * al;
+}
+
+static void pool_add_slab(mem_pool_t *p)
+{
+    ASSERT(p->elems_per_slab > 0);
+
+    if (p->capacity == 0) {
+        p->next_pool = pool_list;
+        pool_list = p;
+    }
+
+    size_t stride = pool_elem_size(p);
+    char *slab = malloc(stride * p->elems_per_slab);
+    ASSERT(slab);
+
+    // Thread the new elements so that they are handed out in address order
+    for (int i = p->elems_per_slab-1; i >= 0; i--) {
+        pool_elem_t *elem = (pool_elem_t *) (slab + i*stride);
+        elem->next = p->free_list;
+        p->free_list = elem;
+    }
+
+    p->capacity += p->elems_per_slab;
+}
+
+void *pool_alloc(mem_pool_t *p)
+{
+    if (!p->free_list)
+        pool_add_slab(p);
+
+    pool_elem_t *elem = p->free_list;
+    p->free_list = elem->next;
+    p->in_use++;
+    return elem;
+}
+
+void pool_free(mem_pool_t *p, void *elem)
+{
+    if (!elem)
+        return;
+
+    ASSERT(p->in_use > 0);
+    pool_elem_t *pe = elem;
+    pe->next = p->free_list;
+    p->free_list = pe;
+    p->in_use--;
+}
+
 struct string_builder_tag {
     char **strings;
     int cnt, cap;
@@ -223,3 +531,10 @@ int prev_cycl(int i, int len)
         i += len; 
     return i;
 }
+
+long get_msec()
+{
+    struct timespec ts = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
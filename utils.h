@@ -32,6 +32,110 @@ bool ll_remove_at(linked_list_t *list, int idx);
 
 static inline bool ll_is_empty(linked_list_t *list) { return list->size == 0; }
 
+// Vector of pointers that keeps the first SVEC_INLINE_CAP elements inside
+//  the struct itself and only goes to the heap when it outgrows them.
+//  Must not be moved after svec_init (data may point into inline_buf)
+#define SVEC_INLINE_CAP 8
+
+typedef struct small_vec_tag {
+    void **data;
+    int size, cap;
+    void *inline_buf[SVEC_INLINE_CAP];
+} small_vec_t;
+
+void svec_init(small_vec_t *v);
+void svec_deinit(small_vec_t *v);
+void svec_push(small_vec_t *v, void *elem);
+int svec_find(small_vec_t *v, void *query);
+// Keeps the order, O(size)
+void svec_remove(small_vec_t *v, int idx);
+// Order is not preserved: the last element takes the removed one's place
+void svec_swap_remove(small_vec_t *v, int idx);
+
+static inline void *svec_at(small_vec_t *v, int idx)
+{
+    return idx >= 0 && idx < v->size ? v->data[idx] : NULL;
+}
+
+static inline void svec_clear(small_vec_t *v) { v->size = 0; }
+static inline bool svec_is_empty(small_vec_t *v) { return v->size == 0; }
+
+// Growable FIFO of pointers, capacity is kept a power of two
+typedef struct ring_buf_tag {
+    void **data;
+    int head, size, cap;
+} ring_buf_t;
+
+void rb_init(ring_buf_t *rb, int init_cap);
+void rb_deinit(ring_buf_t *rb);
+void rb_push_back(ring_buf_t *rb, void *elem);
+void *rb_pop_front(ring_buf_t *rb);
+// Order is not preserved: the back element takes the removed one's place
+void rb_swap_remove(ring_buf_t *rb, int idx);
+
+static inline void *rb_at(ring_buf_t *rb, int idx)
+{
+    return idx >= 0 && idx < rb->size ? rb->data[(rb->head + idx) & (rb->cap-1)] : NULL;
+}
+
+static inline bool rb_is_empty(ring_buf_t *rb) { return rb->size == 0; }
+
+// Open-addressing (linear probing) map from C strings to pointers.
+//  Keys are not copied, the caller keeps them alive while they are in the map
+//  (usually the key points into the value)
+typedef struct hash_map_entry_tag {
+    const char *key;
+    void *val;
+    unsigned int hash;
+} hash_map_entry_t;
+
+typedef struct hash_map_tag {
+    hash_map_entry_t *entries;
+    int size, tombstones, cap;
+} hash_map_t;
+
+void hm_init(hash_map_t *hm, int init_cap);
+void hm_deinit(hash_map_t *hm);
+void *hm_get(hash_map_t *hm, const char *key);
+hash_map_entry_t *hm_find(hash_map_t *hm, const char *key);
+// Inserts or replaces the value, returns the previous value or NULL
+void *hm_put(hash_map_t *hm, const char *key, void *val);
+// Returns the removed value or NULL
+void *hm_remove(hash_map_t *hm, const char *key);
+// Iteration: for (int i = hm_next(hm, -1); i >= 0; i = hm_next(hm, i))
+int hm_next(hash_map_t *hm, int idx);
+
+static inline bool hm_contains(hash_map_t *hm, const char *key) { return hm_find(hm, key) != NULL; }
+
+unsigned int hash_str(const char *s);
+
+// Typed slab pool: objects of one size are carved out of slabs of
+//  elems_per_slab elements and recycled through an intrusive free list.
+//  Slabs are never returned to the system, the pool lives as long as the process
+typedef struct mem_pool_tag {
+    const char *name;
+    size_t elem_size;
+    int elems_per_slab;
+
+    void *free_list;
+    int in_use, capacity;
+
+    // All pools that have allocated a slab, for stats
+    struct mem_pool_tag *next_pool;
+} mem_pool_t;
+
+#define MEM_POOL_INITIALIZER(_type, _elems_per_slab) { \
+    .name = #_type, \
+    .elem_size = sizeof(_type), .elems_per_slab = _elems_per_slab, \
+    .free_list = NULL, .in_use = 0, .capacity = 0, .next_pool = NULL \
+}
+
+void *pool_alloc(mem_pool_t *p);
+void pool_free(mem_pool_t *p, void *elem);
+// Actual per-object footprint, including alignment padding
+size_t pool_elem_size(mem_pool_t *p);
+mem_pool_t *pool_list_head();
+
 typedef struct string_builder_tag string_builder_t;
 
 string_builder_t *sb_create();
@@ -53,6 +157,9 @@ int next_cycl(int i, int len);
 void dec_cycl(int *i, int len); 
 int prev_cycl(int i, int len);
 
+// Monotonic clock
+long get_msec();
+
 static inline int randint(int min, int max)
 {
     return min + (int) ((float) (max-min+1) * rand() / (RAND_MAX+1.0));
@@ -0,0 +1,71 @@
+/* TextGameServer/worker_pool.c */
+#include "worker_pool.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct work_item_tag {
+    work_func_t work_f;
+    completion_func_t done_f;
+    void *ctx;
+} work_item_t;
+
+static ring_buf_t queue                = { 0 };
+static pthread_mutex_t queue_mutex     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond       = PTHREAD_COND_INITIALIZER;
+static bool threads_spawned            = false;
+
+static void *worker_thread_main(void *data);
+
+void wp_init()
+{
+    if (threads_spawned)
+        return;
+
+    rb_init(&queue, WORKER_POOL_QUEUE_MAX);
+    for (int i = 0; i < WORKER_POOL_THREADS; i++) {
+        pthread_t thread;
+        ASSERTF(pthread_create(&thread, NULL, worker_thread_main, NULL) == 0,
+                "Failed to spawn a worker thread\n");
+        pthread_detach(thread);
+    }
+    threads_spawned = true;
+}
+
+bool wp_submit(work_func_t work_f, completion_func_t done_f, void *ctx)
+{
+    ASSERT(threads_spawned);
+
+    pthread_mutex_lock(&queue_mutex);
+    if (queue.size >= WORKER_POOL_QUEUE_MAX) {
+        pthread_mutex_unlock(&queue_mutex);
+        return false;
+    }
+
+    work_item_t *item = malloc(sizeof(*item));
+    item->work_f = work_f;
+    item->done_f = done_f;
+    item->ctx = ctx;
+    rb_push_back(&queue, item);
+
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return true;
+}
+
+static void *worker_thread_main(void *data)
+{
+    for (;;) {
+        pthread_mutex_lock(&queue_mutex);
+        while (rb_is_empty(&queue))
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        work_item_t *item = rb_pop_front(&queue);
+        pthread_mutex_unlock(&queue_mutex);
+
+        bool ok = (*item->work_f)(item->ctx);
+        cq_post(item->done_f, item->ctx, ok);
+        free(item);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,22 @@
+/* TextGameServer/worker_pool.h */
+#ifndef WORKER_POOL_SENTRY
+#define WORKER_POOL_SENTRY
+
+#include "defs.h"
+#include "completion_queue.h"
+
+// Fixed set of threads for CPU-heavy jobs (like password hashing) that
+//  should not stall the event loop. work_f runs on a worker, then done_f is
+//  called with its result on the event loop thread via the completion queue.
+//  The queue is bounded: when it is full, submission fails and the caller
+//  should report the server as busy instead of piling up work.
+
+#define WORKER_POOL_THREADS   4
+#define WORKER_POOL_QUEUE_MAX 256
+
+typedef bool (*work_func_t)(void *ctx);
+
+void wp_init();
+bool wp_submit(work_func_t work_f, completion_func_t done_f, void *ctx);
+
+#endif